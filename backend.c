@@ -0,0 +1,53 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "backend.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static int
+linux_open(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+static int
+linux_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+const struct omapfb_backend omapfb_linux_backend = {
+	.name = "linux",
+	.open = linux_open,
+	.close = close,
+	.ioctl = linux_ioctl,
+	.mmap = mmap,
+	.munmap = munmap,
+};
+
+const struct omapfb_backend *
+omapfb_backend_get(void)
+{
+	static const struct omapfb_backend *backend;
+	const char *name;
+
+	if (backend)
+		return backend;
+
+	name = getenv("OMAPFB_BACKEND");
+	if (name && !strcmp(name, "mock"))
+		backend = &omapfb_mock_backend;
+	else
+		backend = &omapfb_linux_backend;
+
+	return backend;
+}
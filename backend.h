@@ -0,0 +1,32 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <sys/types.h>
+
+/*
+ * Device access of the sink. The linux backend goes straight to the kernel;
+ * the mock backend emulates omapfb in memory so the sink can run, and be
+ * benchmarked, on a host without OMAP hardware.
+ */
+struct omapfb_backend {
+	const char *name;
+	int (*open)(const char *path, int flags);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long request, void *arg);
+	void *(*mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+	int (*munmap)(void *addr, size_t length);
+};
+
+extern const struct omapfb_backend omapfb_linux_backend;
+extern const struct omapfb_backend omapfb_mock_backend;
+
+/* picked once from the OMAPFB_BACKEND environment variable ("linux" or "mock") */
+const struct omapfb_backend *omapfb_backend_get(void);
+
+#endif /* BACKEND_H */
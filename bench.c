@@ -0,0 +1,419 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Benchmark and conformance check of the conversion kernels.
+ *
+ * Every kernel of every implementation the CPU supports is checked byte for
+ * byte against the C implementation, including the bytes around the
+ * destination so overruns are caught, and then timed. The rotating
+ * conversion, which has a single implementation, is checked against a
+ * per-pixel reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "image-format-conversions.h"
+
+#define GUARD 64
+
+struct resolution {
+	const char *name;
+	int width, height;
+};
+
+static const struct resolution resolutions[] = {
+	{ "QVGA", 320, 240 },
+	{ "VGA", 640, 480 },
+	{ "WVGA", 800, 480 },
+	{ "SVGA", 800, 600 },
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	/* widths that are not a multiple of the vector sizes */
+	{ "odd", 18, 16 },
+	{ "odd", 174, 144 },
+	{ "odd", 338, 240 },
+	{ "odd", 1366, 768 },
+};
+
+enum kernel {
+	KERNEL_I420,
+	KERNEL_NV12,
+	KERNEL_NV21,
+	KERNEL_PACKED,
+	KERNEL_I420_BOX2,
+	KERNEL_I420_BOX4,
+	KERNEL_COUNT,
+};
+
+static const char *kernel_names[] = {
+	"uv12_to_uyvy",
+	"nv12_to_uyvy",
+	"nv21_to_uyvy",
+	"packed_line_copy",
+	"uv12_to_uyvy_box/2",
+	"uv12_to_uyvy_box/4",
+};
+
+struct frame {
+	int width, height;
+	int y_pitch, uv_pitch, nv_pitch, packed_pitch;
+	uint8_t *y, *u, *v, *uv, *packed;
+	size_t dest_size;
+	/* the conformance check writes into a wider canvas, like a mosaic tile */
+	int tile_pitch;
+	size_t tile_size;
+};
+
+static unsigned min_time_ms = 200;
+static int failures;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *
+random_plane(size_t size)
+{
+	uint8_t *p = malloc(size);
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		p[i] = rand();
+
+	return p;
+}
+
+static void
+frame_init(struct frame *f, int width, int height)
+{
+	f->width = width;
+	f->height = height;
+	/* strides as GStreamer lays them out */
+	f->y_pitch = (width + 3) & ~3;
+	f->uv_pitch = ((f->y_pitch / 2) + 3) & ~3;
+	f->nv_pitch = f->y_pitch;
+	f->packed_pitch = width * 2 + 32;
+
+	f->y = random_plane(f->y_pitch * height);
+	f->u = random_plane(f->uv_pitch * height / 2);
+	f->v = random_plane(f->uv_pitch * height / 2);
+	f->uv = random_plane(f->nv_pitch * height / 2);
+	f->packed = random_plane(f->packed_pitch * height);
+	f->dest_size = width * height * 2;
+	f->tile_pitch = width * 2 + 64;
+	f->tile_size = f->tile_pitch * height;
+}
+
+static void
+frame_free(struct frame *f)
+{
+	free(f->y);
+	free(f->u);
+	free(f->v);
+	free(f->uv);
+	free(f->packed);
+}
+
+static int
+box_factor(enum kernel k)
+{
+	return k == KERNEL_I420_BOX4 ? 4 : 2;
+}
+
+static void
+run(const struct conversion_impl *impl, enum kernel k, struct frame *f, int dst_pitch, uint8_t *dest)
+{
+	switch (k) {
+	case KERNEL_I420:
+		impl->uv12_to_uyvy(f->width, f->height, f->y_pitch, f->uv_pitch,
+				dst_pitch, f->y, f->u, f->v, dest);
+		break;
+	case KERNEL_NV12:
+		impl->nv12_to_uyvy(f->width, f->height, f->y_pitch, f->nv_pitch,
+				dst_pitch, f->y, f->uv, dest);
+		break;
+	case KERNEL_NV21:
+		impl->nv21_to_uyvy(f->width, f->height, f->y_pitch, f->nv_pitch,
+				dst_pitch, f->y, f->uv, dest);
+		break;
+	case KERNEL_I420_BOX2:
+	case KERNEL_I420_BOX4:
+		impl->uv12_to_uyvy_box(box_factor(k), (f->width / box_factor(k)) & ~1,
+				f->height / box_factor(k), f->y_pitch, f->uv_pitch,
+				dst_pitch, f->y, f->u, f->v, dest);
+		break;
+	default:
+		impl->packed_line_copy(f->width, f->height, f->packed_pitch, dst_pitch,
+				f->packed, dest);
+		break;
+	}
+}
+
+/* of a contiguous destination */
+static int
+dest_pitch(enum kernel k, struct frame *f)
+{
+	if (k == KERNEL_I420_BOX2 || k == KERNEL_I420_BOX4)
+		return ((f->width / box_factor(k)) & ~1) * 2;
+	return f->width * 2;
+}
+
+/* bytes a kernel writes */
+static size_t
+dest_bytes(enum kernel k, struct frame *f)
+{
+	if (k == KERNEL_I420_BOX2 || k == KERNEL_I420_BOX4)
+		return ((f->width / box_factor(k)) & ~1) * (f->height / box_factor(k)) * 2;
+	return f->dest_size;
+}
+
+/* the destination is surrounded by guard bytes that must stay untouched */
+static uint8_t *
+dest_new(size_t size)
+{
+	uint8_t *buf = malloc(size + 2 * GUARD);
+
+	memset(buf, 0xa5, size + 2 * GUARD);
+	return buf;
+}
+
+static int
+check(const struct conversion_impl *ref, const struct conversion_impl *impl,
+		enum kernel k, struct frame *f)
+{
+	uint8_t *expected = dest_new(f->tile_size);
+	uint8_t *result = dest_new(f->tile_size);
+	int ok;
+
+	run(ref, k, f, f->tile_pitch, expected + GUARD);
+	run(impl, k, f, f->tile_pitch, result + GUARD);
+
+	ok = !memcmp(expected, result, f->tile_size + 2 * GUARD);
+
+	free(expected);
+	free(result);
+	return ok;
+}
+
+/* where destination pixel x,y of the rotated and mirrored frame comes from */
+static void
+source_pixel(int rotation, int mirror, int w, int h, int x, int y, int *sx, int *sy)
+{
+	int out_w = (rotation == 90 || rotation == 270) ? h : w;
+
+	if (mirror)
+		x = out_w - 1 - x;
+
+	switch (rotation) {
+	case 90:
+		*sx = y;
+		*sy = h - 1 - x;
+		break;
+	case 180:
+		*sx = w - 1 - x;
+		*sy = h - 1 - y;
+		break;
+	case 270:
+		*sx = w - 1 - y;
+		*sy = x;
+		break;
+	default:
+		*sx = x;
+		*sy = y;
+		break;
+	}
+}
+
+/* average of a cols x rows block, halving columns first as the kernels do */
+static uint8_t
+box_reference(uint8_t *p, int pitch, int step, int cols, int rows)
+{
+	if (cols > 1)
+		return (box_reference(p, pitch, step, cols / 2, rows) +
+				box_reference(p + cols / 2 * step, pitch, step, cols / 2, rows) + 1) / 2;
+	if (rows > 1)
+		return (box_reference(p, pitch, step, 1, rows / 2) +
+				box_reference(p + rows / 2 * pitch, pitch, step, 1, rows / 2) + 1) / 2;
+	return *p;
+}
+
+static void
+rotate_reference(int rotation, int mirror, int factor, int w, int h, int y_pitch, int uv_pitch,
+		int uv_step, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int out_w = (rotation == 90 || rotation == 270) ? h : w;
+	int out_h = w * h / out_w;
+	int x, y, sx, sy, px, py, cx, cy, c, cols, rows;
+
+	for (y = 0; y < out_h; y++) {
+		for (x = 0; x < out_w; x++) {
+			uint8_t *d = dest + (y * out_w + x) * 2;
+
+			source_pixel(rotation, mirror, w, h, x, y, &sx, &sy);
+			/* the pixel sharing this one's chroma */
+			source_pixel(rotation, mirror, w, h, x ^ 1, y, &px, &py);
+			cx = sx < px ? sx : px;
+			cy = sy < py ? sy : py;
+
+			if (factor == 1) {
+				c = cy / 2 * uv_pitch + cx / 2 * uv_step;
+				cols = rows = 1;
+			} else {
+				/* the chroma both pixels of the pair cover */
+				c = cy * factor / 2 * uv_pitch + cx * factor / 2 * uv_step;
+				cols = sx != px ? factor : factor / 2;
+				rows = sy != py ? factor : factor / 2;
+			}
+
+			/* U Y0 V Y1: the even pixel carries U, the odd one V */
+			d[0] = box_reference((x & 1 ? v_p : u_p) + c, uv_pitch, uv_step, cols, rows);
+			d[1] = box_reference(y_p + (sy * y_pitch + sx) * factor, y_pitch, 1, factor, factor);
+		}
+	}
+}
+
+/*
+ * All rotations, with and without mirror and prescale, from separate and
+ * interleaved chroma, converted at once and in stripes as the conversion
+ * threads do.
+ */
+static int
+check_rotate(struct frame *f)
+{
+	size_t size = (f->width & ~1) * (f->height & ~1) * 2;
+	uint8_t *expected = dest_new(size);
+	uint8_t *result = dest_new(size);
+	int factor, rotation, mirror, uv_step, stripe, row, w, h, out_h, ok = 1;
+
+	for (factor = 1; factor <= 4; factor *= 2) {
+		for (rotation = 0; rotation < 360; rotation += 90) {
+			w = (f->width / factor) & ~1;
+			h = (f->height / factor) & ~1;
+			size = w * h * 2;
+			out_h = (rotation == 90 || rotation == 270) ? w : h;
+
+			for (mirror = 0; mirror < 2; mirror++) {
+				for (uv_step = 1; uv_step <= 2; uv_step++) {
+					uint8_t *u = uv_step == 1 ? f->u : f->uv;
+					uint8_t *v = uv_step == 1 ? f->v : f->uv + 1;
+					int uv_pitch = uv_step == 1 ? f->uv_pitch : f->nv_pitch;
+
+					memset(expected, 0xa5, size + 2 * GUARD);
+					rotate_reference(rotation, mirror, factor, w, h, f->y_pitch, uv_pitch,
+							uv_step, f->y, u, v, expected + GUARD);
+
+					/* stripes of 6 rows cut through the 32 pixel tiles */
+					for (stripe = out_h; stripe >= 6; stripe = stripe == 6 ? 0 : 6) {
+						memset(result, 0xa5, size + 2 * GUARD);
+						for (row = 0; row < out_h; row += stripe)
+							yuv420_to_uyvy_rotate(rotation, mirror, factor, w, h, row,
+									row + stripe < out_h ? stripe : out_h - row,
+									f->y_pitch, uv_pitch, uv_step, f->y, u, v,
+									result + GUARD);
+
+						if (memcmp(expected, result, size + 2 * GUARD)) {
+							printf("%-7s %-18s %4dx%-4d %3d%s /%d uv_step %d, %d row stripes MISMATCH\n",
+									"c", "yuv420_to_uyvy_rotate", w, h, rotation,
+									mirror ? " mirrored" : "", factor, uv_step, stripe);
+							ok = 0;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	free(expected);
+	free(result);
+	return ok;
+}
+
+static void
+bench(const struct conversion_impl *impl, enum kernel k, struct frame *f, const char *res_name)
+{
+	uint8_t *dest = dest_new(f->dest_size);
+	unsigned iterations = 0;
+	double start, elapsed, pixels;
+
+	/* warm up the caches */
+	run(impl, k, f, dest_pitch(k, f), dest + GUARD);
+
+	start = now();
+	do {
+		run(impl, k, f, dest_pitch(k, f), dest + GUARD);
+		iterations++;
+		elapsed = now() - start;
+	} while (elapsed * 1000 < min_time_ms);
+
+	pixels = (double) f->width * f->height * iterations;
+	printf("%-7s %-18s %-6s %4dx%-4d %10.1f MB/s %8.3f ns/pixel\n",
+			impl->name, kernel_names[k], res_name, f->width, f->height,
+			dest_bytes(k, f) * iterations / elapsed / 1e6,
+			elapsed * 1e9 / pixels);
+
+	free(dest);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct conversion_impl *impls;
+	unsigned count, i, r;
+	int k;
+
+	if (argc > 1)
+		min_time_ms = atoi(argv[1]);
+
+	impls = conversion_impl_list(&count);
+
+	printf("default implementation: %s, into framebuffer memory: %s\n",
+			conversion_impl_get()->name, conversion_impl_get_fb()->name);
+
+	for (r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+		const struct resolution *res = &resolutions[r];
+		struct frame f;
+
+		frame_init(&f, res->width, res->height);
+
+		for (k = 0; k < KERNEL_COUNT; k++) {
+			for (i = 0; i < count; i++) {
+				if (!conversion_impl_supported(&impls[i]))
+					continue;
+
+				if (i && !check(&impls[0], &impls[i], k, &f)) {
+					printf("%-7s %-18s %-6s %4dx%-4d MISMATCH\n",
+							impls[i].name, kernel_names[k], res->name,
+							f.width, f.height);
+					failures++;
+					continue;
+				}
+
+				if (min_time_ms)
+					bench(&impls[i], k, &f, res->name);
+			}
+		}
+
+		if (!check_rotate(&f))
+			failures++;
+
+		frame_free(&f);
+	}
+
+	if (failures)
+		printf("%d kernels do not match the C implementation\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "convert-pool.h"
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#define MAX_THREADS 8
+
+struct convert_pool {
+	unsigned nthreads;
+	GThread *workers[MAX_THREADS];
+
+	GMutex lock;
+	GCond job_cond;
+	GCond done_cond;
+	bool quit;
+
+	/* current job */
+	unsigned job;
+	convert_stripe_func func;
+	void *data;
+	int rows;
+	int stripe_rows;
+	int nstripes;
+	int next_stripe;
+	int done;
+};
+
+/* returns false when there is no stripe left; must be called with the lock held */
+static bool
+run_stripe(struct convert_pool *pool)
+{
+	int first, rows;
+
+	if (pool->next_stripe >= pool->nstripes)
+		return false;
+
+	first = pool->next_stripe++ * pool->stripe_rows;
+	rows = MIN(pool->stripe_rows, pool->rows - first);
+
+	g_mutex_unlock(&pool->lock);
+	if (rows > 0)
+		pool->func(pool->data, first, rows);
+	g_mutex_lock(&pool->lock);
+
+	if (++pool->done == pool->nstripes)
+		g_cond_signal(&pool->done_cond);
+
+	return true;
+}
+
+static gpointer
+worker_loop(gpointer data)
+{
+	struct convert_pool *pool = data;
+	unsigned job = 0;
+
+	g_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->quit && pool->job == job)
+			g_cond_wait(&pool->job_cond, &pool->lock);
+		if (pool->quit)
+			break;
+		job = pool->job;
+
+		while (run_stripe(pool));
+	}
+	g_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct convert_pool *
+convert_pool_new(unsigned threads)
+{
+	struct convert_pool *pool;
+	unsigned i;
+
+	if (!threads)
+		threads = g_get_num_processors();
+	threads = CLAMP(threads, 1, MAX_THREADS);
+
+	pool = g_new0(struct convert_pool, 1);
+	g_mutex_init(&pool->lock);
+	g_cond_init(&pool->job_cond);
+	g_cond_init(&pool->done_cond);
+
+	/* the caller is the first thread */
+	pool->nthreads = 1;
+	for (i = 1; i < threads; i++) {
+		pool->workers[i] = g_thread_try_new("omapfb-convert", worker_loop, pool, NULL);
+		if (!pool->workers[i])
+			break;
+		pool->nthreads++;
+	}
+
+	return pool;
+}
+
+void
+convert_pool_free(struct convert_pool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+
+	g_mutex_lock(&pool->lock);
+	pool->quit = true;
+	g_cond_broadcast(&pool->job_cond);
+	g_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->nthreads; i++)
+		g_thread_join(pool->workers[i]);
+
+	g_cond_clear(&pool->done_cond);
+	g_cond_clear(&pool->job_cond);
+	g_mutex_clear(&pool->lock);
+	g_free(pool);
+}
+
+unsigned
+convert_pool_threads(struct convert_pool *pool)
+{
+	return pool ? pool->nthreads : 1;
+}
+
+void
+convert_pool_run(struct convert_pool *pool, int rows, int align,
+		convert_stripe_func func, void *data)
+{
+	int stripe_rows;
+
+	if (!pool || pool->nthreads == 1 || rows < 2 * align) {
+		func(data, 0, rows);
+		return;
+	}
+
+	stripe_rows = (rows + pool->nthreads - 1) / pool->nthreads;
+	stripe_rows = (stripe_rows + align - 1) / align * align;
+
+	g_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->data = data;
+	pool->rows = rows;
+	pool->stripe_rows = stripe_rows;
+	pool->nstripes = (rows + stripe_rows - 1) / stripe_rows;
+	pool->next_stripe = 0;
+	pool->done = 0;
+	pool->job++;
+	g_cond_broadcast(&pool->job_cond);
+
+	while (run_stripe(pool));
+
+	while (pool->done < pool->nstripes)
+		g_cond_wait(&pool->done_cond, &pool->lock);
+	g_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef CONVERT_POOL_H
+#define CONVERT_POOL_H
+
+/*
+ * Stripe-parallel frame conversion.
+ *
+ * A frame of 'rows' lines is cut into one horizontal stripe per thread; each
+ * stripe starts on a multiple of 'align' rows so chroma subsampled formats
+ * never split a row pair. The calling thread converts a stripe too and
+ * returns once the whole frame is done.
+ */
+
+typedef void (*convert_stripe_func)(void *data, int first_row, int rows);
+
+struct convert_pool;
+
+/* threads == 0 picks one thread per online CPU */
+struct convert_pool *convert_pool_new(unsigned threads);
+void convert_pool_free(struct convert_pool *pool);
+
+unsigned convert_pool_threads(struct convert_pool *pool);
+
+void convert_pool_run(struct convert_pool *pool, int rows, int align,
+		convert_stripe_func func, void *data);
+
+#endif /* CONVERT_POOL_H */
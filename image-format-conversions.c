@@ -33,6 +33,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #ifdef __arm__
 #define HAVE_NEON
@@ -41,14 +42,19 @@
 #ifndef asm
 #define asm __asm
 #endif
-#else
+#elif defined(__i386__) || defined(__x86_64__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
 #endif
 
 
 #include "image-format-conversions.h"
 
+/* how far ahead of the loads the source planes are prefetched, in bytes */
+#define PREFETCH_AHEAD 256
+
 /* Basic line-based copy for packed formats */
-void packed_line_copy(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+static void packed_line_copy_c(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
 {
 	int i;
 	int len = w * 2;
@@ -58,14 +64,12 @@ void packed_line_copy(int w, int h, int src_stride, int dst_stride, uint8_t *src
 	}
 }
 
-#ifndef HAVE_NEON
-
 /* Basic C implementation of YV12/I420 to UYVY conversion */
-void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+static void uv12_to_uyvy_c(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
 {
 	int x, y;
 	uint8_t *dest_even = dest;
-	uint8_t *dest_odd = dest + w * 2;
+	uint8_t *dest_odd = dest + dst_pitch;
 	uint8_t *y_p_even = y_p;
 	uint8_t *y_p_odd = y_p + y_pitch;
 
@@ -98,8 +102,8 @@ void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t
 /*                        printf("x=%d y=%d 4\n", x, y);*/
 		}
 
-		dest_even += w * 2;
-		dest_odd += w * 2;
+		dest_even += 2 * dst_pitch - w * 2;
+		dest_odd += 2 * dst_pitch - w * 2;
 
 		u_p += ((uv_pitch << 1) - w) >> 1;
 		v_p += ((uv_pitch << 1) - w) >> 1;
@@ -109,54 +113,139 @@ void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t
 	}
 }
 
-#endif /* ! HAVE_NEON */
+/*
+ * Basic C implementation of NV12/NV21 to UYVY conversion; the chroma plane
+ * holds interleaved U,V (NV12) or V,U (NV21) pairs.
+ */
+static void nv_to_uyvy_c(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+	int x, y;
+	uint8_t *dest_even = dest;
+	uint8_t *dest_odd = dest + dst_pitch;
+	uint8_t *y_p_even = y_p;
+	uint8_t *y_p_odd = y_p + y_pitch;
 
-#ifdef HAVE_NEON
+	for (y=0; y<h; y+=2)
+	{
+		for (x=0; x<w; x+=2)
+		{
+			/* Output two 2x1 macroblocks to form a 2x2 block from input */
+			uint8_t u_val = uv_p[swap];
+			uint8_t v_val = uv_p[!swap];
+			uv_p += 2;
 
-void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+			/* Even row */
+			*dest_even++ = u_val;
+			*dest_even++ = *y_p_even++;
+			*dest_even++ = v_val;
+			*dest_even++ = *y_p_even++;
+
+			/* Odd row */
+			*dest_odd++ = u_val;
+			*dest_odd++ = *y_p_odd++;
+			*dest_odd++ = v_val;
+			*dest_odd++ = *y_p_odd++;
+		}
+
+		dest_even += 2 * dst_pitch - w * 2;
+		dest_odd += 2 * dst_pitch - w * 2;
+
+		uv_p += uv_pitch - w;
+
+		y_p_even += (y_pitch - w) + y_pitch;
+		y_p_odd += (y_pitch - w) + y_pitch;
+	}
+}
+
+static void nv12_to_uyvy_c(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
 {
-    int x, y;
-    uint8_t *dest_even = dest;
-    uint8_t *dest_odd = dest + w * 2;
-    uint8_t *y_p_even = y_p;
-    uint8_t *y_p_odd = y_p + y_pitch;
+	nv_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 0);
+}
 
-    if (w<16)
-    {
-        for (y=0; y<h; y+=2)
-        {
-            for (x=0; x<w; x+=2)
-            {
-                /* Output two 2x1 macroblocks to form a 2x2 block from input */
-                uint8_t u_val = *u_p++;
-                uint8_t v_val = *v_p++;
+static void nv21_to_uyvy_c(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	nv_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 1);
+}
 
-                /* Even row, first pixel */
-                *dest_even++ = u_val;
-                *dest_even++ = *y_p_even++;
+static inline uint8_t avg2(uint8_t a, uint8_t b)
+{
+	return (a + b + 1) >> 1;
+}
 
-                /* Even row, second pixel */
-                *dest_even++ = v_val;
-                *dest_even++ = *y_p_even++;
+/*
+ * Box filter over cols x rows source samples. It is built from rounding
+ * averages of pairs, vertical first, so the SIMD versions can use their
+ * averaging instructions and still match it bit for bit.
+ */
+/* average of a cols x rows block, 1, 2 or 4 each way, step bytes between columns */
+static uint8_t box_step_c(uint8_t *p, int pitch, int step, int cols, int rows)
+{
+	uint8_t v[4];
+	int i;
 
-                /* Odd row, first pixel */
-                *dest_odd++ = u_val;
-                *dest_odd++ = *y_p_odd++;
+	for (i = 0; i < cols; i++)
+	{
+		uint8_t *c = p + i * step;
 
-                /* Odd row, second pixel */
-                *dest_odd++ = v_val;
-                *dest_odd++ = *y_p_odd++;
-            }
+		if (rows == 4)
+			v[i] = avg2(avg2(c[0], c[pitch]), avg2(c[2 * pitch], c[3 * pitch]));
+		else if (rows == 2)
+			v[i] = avg2(c[0], c[pitch]);
+		else
+			v[i] = c[0];
+	}
 
-            dest_even += w * 2;
-            dest_odd += w * 2;
+	if (cols == 4)
+		return avg2(avg2(v[0], v[1]), avg2(v[2], v[3]));
+	if (cols == 2)
+		return avg2(v[0], v[1]);
+	return v[0];
+}
 
-            u_p += ((uv_pitch << 1) - w) >> 1;
-            v_p += ((uv_pitch << 1) - w) >> 1;
+static uint8_t box_c(uint8_t *p, int pitch, int cols, int rows)
+{
+	return box_step_c(p, pitch, 1, cols, rows);
+}
 
-            y_p_even += (y_pitch - w) + y_pitch;
-            y_p_odd += (y_pitch - w) + y_pitch;
-        }
+/*
+ * YV12/I420 to UYVY with a 2x2 or 4x4 box downscale. w and h are the
+ * destination size; each UYVY pixel pair averages factor x factor luma
+ * samples per pixel and factor x factor/2 chroma samples.
+ */
+static void uv12_to_uyvy_box_c(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	for (y = 0; y < h; y++)
+	{
+		uint8_t *d = dest + y * dst_pitch;
+		uint8_t *y_row = y_p + y * factor * y_pitch;
+		uint8_t *u_row = u_p + y * factor / 2 * uv_pitch;
+		uint8_t *v_row = v_p + y * factor / 2 * uv_pitch;
+
+		for (x = 0; x < w; x += 2)
+		{
+			*d++ = box_c(u_row + x * factor / 2, uv_pitch, factor, factor / 2);
+			*d++ = box_c(y_row + x * factor, y_pitch, factor, factor);
+			*d++ = box_c(v_row + x * factor / 2, uv_pitch, factor, factor / 2);
+			*d++ = box_c(y_row + (x + 1) * factor, y_pitch, factor, factor);
+		}
+	}
+}
+
+#ifdef HAVE_NEON
+
+static void uv12_to_uyvy_neon(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+    int x, y;
+    uint8_t *dest_even = dest;
+    uint8_t *dest_odd = dest + dst_pitch;
+    uint8_t *y_p_even = y_p;
+    uint8_t *y_p_odd = y_p + y_pitch;
+
+    if (w<16)
+    {
+        uv12_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
     }
     else
     {
@@ -201,8 +290,8 @@ void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t
             }
             while (x!=0);
 
-            dest_even += w * 2;
-            dest_odd += w * 2;
+            dest_even += 2 * dst_pitch - w * 2;
+            dest_odd += 2 * dst_pitch - w * 2;
 
             u_p += ((uv_pitch << 1) - w) >> 1;
             v_p += ((uv_pitch << 1) - w) >> 1;
@@ -213,4 +302,1060 @@ void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t
     }
 }
 
+/*
+ * The chroma plane is already interleaved, so one load replaces the U/V zip;
+ * NV21 only needs the bytes of each V,U pair reversed.
+ */
+static void nv_to_uyvy_neon(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+    int x, y;
+    uint8_t *dest_even = dest;
+    uint8_t *dest_odd = dest + dst_pitch;
+    uint8_t *y_p_even = y_p;
+    uint8_t *y_p_odd = y_p + y_pitch;
+
+    if (w<16)
+    {
+        nv_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, swap);
+        return;
+    }
+
+    for (y=0; y<h; y+=2)
+    {
+        x=w;
+        do {
+            // avoid using d8-d15 (q4-q7) aapcs callee-save registers
+            if (swap)
+                asm volatile (
+                        "1:\n\t"
+                        "vld1.u8   {q0}, [%[uv_p]]!\n\t"
+                        "sub       %[x],%[x],#16\n\t"
+                        "cmp       %[x],#16\n\t"
+                        "vld1.u8   {q1}, [%[y_p_even]]!\n\t"
+                        "vrev16.8  q0, q0\n\t"
+                        "vld1.u8   {q2}, [%[y_p_odd]]!\n\t"
+                        "vst2.u8   {q0,q1}, [%[dest_even]]!\n\t"
+                        "vmov.u8   q1, q2\n\t"
+                        "vst2.u8   {q0,q1}, [%[dest_odd]]!\n\t"
+                        "bhs       1b\n\t"
+                        : [uv_p] "+r" (uv_p), [y_p_even] "+r" (y_p_even), [y_p_odd] "+r" (y_p_odd),
+                          [dest_even] "+r" (dest_even), [dest_odd] "+r" (dest_odd),
+                          [x] "+r" (x)
+                        :
+                        : "cc", "memory", "d0","d1","d2","d3","d4","d5"
+                        );
+            else
+                asm volatile (
+                        "1:\n\t"
+                        "vld1.u8   {q0}, [%[uv_p]]!\n\t"
+                        "sub       %[x],%[x],#16\n\t"
+                        "cmp       %[x],#16\n\t"
+                        "vld1.u8   {q1}, [%[y_p_even]]!\n\t"
+                        "vld1.u8   {q2}, [%[y_p_odd]]!\n\t"
+                        "vst2.u8   {q0,q1}, [%[dest_even]]!\n\t"
+                        "vmov.u8   q1, q2\n\t"
+                        "vst2.u8   {q0,q1}, [%[dest_odd]]!\n\t"
+                        "bhs       1b\n\t"
+                        : [uv_p] "+r" (uv_p), [y_p_even] "+r" (y_p_even), [y_p_odd] "+r" (y_p_odd),
+                          [dest_even] "+r" (dest_even), [dest_odd] "+r" (dest_odd),
+                          [x] "+r" (x)
+                        :
+                        : "cc", "memory", "d0","d1","d2","d3","d4","d5"
+                        );
+            if (x!=0)
+            {
+                // overlap final 16-pixel block to process requested width exactly
+                x = 16-x;
+                uv_p -= x;
+                y_p_even -= x;
+                y_p_odd -= x;
+                dest_even -= x*2;
+                dest_odd -= x*2;
+                x = 16;
+                // do another 16-pixel block
+            }
+        }
+        while (x!=0);
+
+        dest_even += 2 * dst_pitch - w * 2;
+        dest_odd += 2 * dst_pitch - w * 2;
+
+        uv_p += uv_pitch - w;
+
+        y_p_even += (y_pitch - w) + y_pitch;
+        y_p_odd += (y_pitch - w) + y_pitch;
+    }
+}
+
+static void nv12_to_uyvy_neon(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+    nv_to_uyvy_neon(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 0);
+}
+
+static void nv21_to_uyvy_neon(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+    nv_to_uyvy_neon(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 1);
+}
+
+/*
+ * Write-combining friendly variants. The overlay memory is mapped
+ * write-combined, so rather than alternating between the even and odd
+ * destination rows every 32 bytes, each row is written front to back in
+ * 64-byte bursts, and the sources are preloaded ahead of use. The chroma
+ * row is read twice, but it is cached by then.
+ */
+static void uv12_row_to_uyvy_neon_wc(int w, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+    int x;
+
+    for (x = 0; x < w; x += 32)
+    {
+        uint8x16x2_t uv, lo, hi;
+
+        // overlap the final 32-pixel block to process the width exactly
+        if (x > w - 32)
+            x = w - 32;
+
+        __builtin_prefetch(y_p + x + PREFETCH_AHEAD);
+        __builtin_prefetch(u_p + x / 2 + PREFETCH_AHEAD / 2);
+        __builtin_prefetch(v_p + x / 2 + PREFETCH_AHEAD / 2);
+
+        uv = vzipq_u8(vld1q_u8(u_p + x / 2), vld1q_u8(v_p + x / 2));
+        lo.val[0] = uv.val[0];
+        lo.val[1] = vld1q_u8(y_p + x);
+        hi.val[0] = uv.val[1];
+        hi.val[1] = vld1q_u8(y_p + x + 16);
+
+        vst2q_u8(dest + x * 2, lo);
+        vst2q_u8(dest + x * 2 + 32, hi);
+    }
+}
+
+static void uv12_to_uyvy_neon_wc(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+    int y;
+
+    if (w < 32)
+    {
+        uv12_to_uyvy_neon(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+        return;
+    }
+
+    for (y = 0; y < h; y++)
+        uv12_row_to_uyvy_neon_wc(w, y_p + y * y_pitch,
+                u_p + (y / 2) * uv_pitch, v_p + (y / 2) * uv_pitch,
+                dest + y * dst_pitch);
+}
+
+static void nv_row_to_uyvy_neon_wc(int w, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+    int x;
+
+    for (x = 0; x < w; x += 32)
+    {
+        uint8x16x2_t lo, hi;
+
+        // overlap the final 32-pixel block to process the width exactly
+        if (x > w - 32)
+            x = w - 32;
+
+        __builtin_prefetch(y_p + x + PREFETCH_AHEAD);
+        __builtin_prefetch(uv_p + x + PREFETCH_AHEAD);
+
+        lo.val[0] = vld1q_u8(uv_p + x);
+        lo.val[1] = vld1q_u8(y_p + x);
+        hi.val[0] = vld1q_u8(uv_p + x + 16);
+        hi.val[1] = vld1q_u8(y_p + x + 16);
+
+        if (swap)
+        {
+            lo.val[0] = vrev16q_u8(lo.val[0]);
+            hi.val[0] = vrev16q_u8(hi.val[0]);
+        }
+
+        vst2q_u8(dest + x * 2, lo);
+        vst2q_u8(dest + x * 2 + 32, hi);
+    }
+}
+
+static void nv_to_uyvy_neon_wc(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+    int y;
+
+    if (w < 32)
+    {
+        nv_to_uyvy_neon(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, swap);
+        return;
+    }
+
+    for (y = 0; y < h; y++)
+        nv_row_to_uyvy_neon_wc(w, y_p + y * y_pitch, uv_p + (y / 2) * uv_pitch,
+                dest + y * dst_pitch, swap);
+}
+
+static void nv12_to_uyvy_neon_wc(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+    nv_to_uyvy_neon_wc(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 0);
+}
+
+static void nv21_to_uyvy_neon_wc(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+    nv_to_uyvy_neon_wc(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 1);
+}
+
+/*
+ * Box downscale, 16 destination pixels per iteration: vld2/vld4 split the
+ * source columns by phase, so both averaging steps are plain vrhadd.
+ */
+static void uv12_to_uyvy_box_neon(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+    int x, y;
+
+    if (w < 16)
+    {
+        uv12_to_uyvy_box_c(factor, w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+        return;
+    }
+
+    for (y = 0; y < h; y++)
+    {
+        uint8_t *d = dest + y * dst_pitch;
+        uint8_t *y_row = y_p + y * factor * y_pitch;
+        uint8_t *u_row = u_p + y * factor / 2 * uv_pitch;
+        uint8_t *v_row = v_p + y * factor / 2 * uv_pitch;
+
+        for (x = 0; x < w; x += 16)
+        {
+            uint8x16x2_t out;
+            uint8x8_t u, v;
+            uint8x8x2_t uv;
+
+            // overlap the final 16-pixel block to process the width exactly
+            if (x > w - 16)
+                x = w - 16;
+
+            __builtin_prefetch(y_row + x * factor + PREFETCH_AHEAD);
+            __builtin_prefetch(y_row + y_pitch + x * factor + PREFETCH_AHEAD);
+
+            if (factor == 2)
+            {
+                uint8x16x2_t r0 = vld2q_u8(y_row + x * 2);
+                uint8x16x2_t r1 = vld2q_u8(y_row + y_pitch + x * 2);
+                uint8x8x2_t cu = vld2_u8(u_row + x);
+                uint8x8x2_t cv = vld2_u8(v_row + x);
+
+                out.val[1] = vrhaddq_u8(vrhaddq_u8(r0.val[0], r1.val[0]),
+                        vrhaddq_u8(r0.val[1], r1.val[1]));
+                u = vrhadd_u8(cu.val[0], cu.val[1]);
+                v = vrhadd_u8(cv.val[0], cv.val[1]);
+            }
+            else
+            {
+                uint8x16x4_t r0 = vld4q_u8(y_row + x * 4);
+                uint8x16x4_t r1 = vld4q_u8(y_row + y_pitch + x * 4);
+                uint8x16x4_t r2 = vld4q_u8(y_row + 2 * y_pitch + x * 4);
+                uint8x16x4_t r3 = vld4q_u8(y_row + 3 * y_pitch + x * 4);
+                uint8x8x4_t u0 = vld4_u8(u_row + x * 2);
+                uint8x8x4_t u1 = vld4_u8(u_row + uv_pitch + x * 2);
+                uint8x8x4_t v0 = vld4_u8(v_row + x * 2);
+                uint8x8x4_t v1 = vld4_u8(v_row + uv_pitch + x * 2);
+                uint8x16_t c[4];
+                uint8x8_t cu[4], cv[4];
+                int i;
+
+                for (i = 0; i < 4; i++)
+                {
+                    c[i] = vrhaddq_u8(vrhaddq_u8(r0.val[i], r1.val[i]),
+                            vrhaddq_u8(r2.val[i], r3.val[i]));
+                    cu[i] = vrhadd_u8(u0.val[i], u1.val[i]);
+                    cv[i] = vrhadd_u8(v0.val[i], v1.val[i]);
+                }
+
+                out.val[1] = vrhaddq_u8(vrhaddq_u8(c[0], c[1]), vrhaddq_u8(c[2], c[3]));
+                u = vrhadd_u8(vrhadd_u8(cu[0], cu[1]), vrhadd_u8(cu[2], cu[3]));
+                v = vrhadd_u8(vrhadd_u8(cv[0], cv[1]), vrhadd_u8(cv[2], cv[3]));
+            }
+
+            uv = vzip_u8(u, v);
+            out.val[0] = vcombine_u8(uv.val[0], uv.val[1]);
+
+            vst2q_u8(d + x * 2, out);
+        }
+    }
+}
+
+static void packed_line_copy_neon_wc(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+{
+    int i, x;
+    int len = w * 2;
+
+    for (i = 0; i < h; i++)
+    {
+        uint8_t *s = src + i * src_stride;
+        uint8_t *d = dest + i * dst_stride;
+
+        for (x = 0; x + 64 <= len; x += 64)
+        {
+            uint8x16_t a, b, c, e;
+
+            __builtin_prefetch(s + x + PREFETCH_AHEAD);
+            a = vld1q_u8(s + x);
+            b = vld1q_u8(s + x + 16);
+            c = vld1q_u8(s + x + 32);
+            e = vld1q_u8(s + x + 48);
+            vst1q_u8(d + x, a);
+            vst1q_u8(d + x + 16, b);
+            vst1q_u8(d + x + 32, c);
+            vst1q_u8(d + x + 48, e);
+        }
+        memcpy(d + x, s + x, len - x);
+    }
+}
+
 #endif /* HAVE_NEON */
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void packed_line_copy_sse2(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+{
+	int i, x;
+	int len = w * 2;
+
+	for (i = 0; i < h; i++)
+	{
+		uint8_t *s = src + i * src_stride;
+		uint8_t *d = dest + i * dst_stride;
+
+		for (x = 0; x + 64 <= len; x += 64)
+		{
+			__m128i a = _mm_loadu_si128((__m128i *)(s + x));
+			__m128i b = _mm_loadu_si128((__m128i *)(s + x + 16));
+			__m128i c = _mm_loadu_si128((__m128i *)(s + x + 32));
+			__m128i e = _mm_loadu_si128((__m128i *)(s + x + 48));
+			_mm_storeu_si128((__m128i *)(d + x), a);
+			_mm_storeu_si128((__m128i *)(d + x + 16), b);
+			_mm_storeu_si128((__m128i *)(d + x + 32), c);
+			_mm_storeu_si128((__m128i *)(d + x + 48), e);
+		}
+		memcpy(d + x, s + x, len - x);
+	}
+}
+
+/*
+ * 16 pixels of a row pair per iteration: U and V are zipped, then the chroma
+ * pairs are zipped with each luma row to form UYVY.
+ */
+__attribute__((target("sse2")))
+static void uv12_to_uyvy_sse2(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	if (w < 16)
+	{
+		uv12_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+		return;
+	}
+
+	for (y = 0; y < h; y += 2)
+	{
+		uint8_t *dest_even = dest + y * dst_pitch;
+		uint8_t *dest_odd = dest_even + dst_pitch;
+		uint8_t *y_p_even = y_p + y * y_pitch;
+		uint8_t *y_p_odd = y_p_even + y_pitch;
+		uint8_t *u_row = u_p + (y / 2) * uv_pitch;
+		uint8_t *v_row = v_p + (y / 2) * uv_pitch;
+
+		for (x = 0; x < w; x += 16)
+		{
+			__m128i u, v, uv, ye, yo;
+
+			/* overlap the final 16-pixel block to process the width exactly */
+			if (x > w - 16)
+				x = w - 16;
+
+			u = _mm_loadl_epi64((__m128i *)(u_row + x / 2));
+			v = _mm_loadl_epi64((__m128i *)(v_row + x / 2));
+			uv = _mm_unpacklo_epi8(u, v);
+			ye = _mm_loadu_si128((__m128i *)(y_p_even + x));
+			yo = _mm_loadu_si128((__m128i *)(y_p_odd + x));
+
+			_mm_storeu_si128((__m128i *)(dest_even + x * 2), _mm_unpacklo_epi8(uv, ye));
+			_mm_storeu_si128((__m128i *)(dest_even + x * 2 + 16), _mm_unpackhi_epi8(uv, ye));
+			_mm_storeu_si128((__m128i *)(dest_odd + x * 2), _mm_unpacklo_epi8(uv, yo));
+			_mm_storeu_si128((__m128i *)(dest_odd + x * 2 + 16), _mm_unpackhi_epi8(uv, yo));
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static void nv_to_uyvy_sse2(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+	int x, y;
+
+	if (w < 16)
+	{
+		nv_to_uyvy_c(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, swap);
+		return;
+	}
+
+	for (y = 0; y < h; y += 2)
+	{
+		uint8_t *dest_even = dest + y * dst_pitch;
+		uint8_t *dest_odd = dest_even + dst_pitch;
+		uint8_t *y_p_even = y_p + y * y_pitch;
+		uint8_t *y_p_odd = y_p_even + y_pitch;
+		uint8_t *uv_row = uv_p + (y / 2) * uv_pitch;
+
+		for (x = 0; x < w; x += 16)
+		{
+			__m128i uv, ye, yo;
+
+			/* overlap the final 16-pixel block to process the width exactly */
+			if (x > w - 16)
+				x = w - 16;
+
+			uv = _mm_loadu_si128((__m128i *)(uv_row + x));
+			if (swap)
+				uv = _mm_or_si128(_mm_slli_epi16(uv, 8), _mm_srli_epi16(uv, 8));
+			ye = _mm_loadu_si128((__m128i *)(y_p_even + x));
+			yo = _mm_loadu_si128((__m128i *)(y_p_odd + x));
+
+			_mm_storeu_si128((__m128i *)(dest_even + x * 2), _mm_unpacklo_epi8(uv, ye));
+			_mm_storeu_si128((__m128i *)(dest_even + x * 2 + 16), _mm_unpackhi_epi8(uv, ye));
+			_mm_storeu_si128((__m128i *)(dest_odd + x * 2), _mm_unpacklo_epi8(uv, yo));
+			_mm_storeu_si128((__m128i *)(dest_odd + x * 2 + 16), _mm_unpackhi_epi8(uv, yo));
+		}
+	}
+}
+
+static void nv12_to_uyvy_sse2(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	nv_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 0);
+}
+
+static void nv21_to_uyvy_sse2(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	nv_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 1);
+}
+
+/*
+ * Same as the SSE2 kernel with 32 pixels per iteration. The 256-bit unpacks
+ * work per 128-bit lane, so the results are put back in order with a final
+ * lane permute.
+ */
+__attribute__((target("avx2")))
+static void uv12_to_uyvy_avx2(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	if (w < 32)
+	{
+		uv12_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+		return;
+	}
+
+	for (y = 0; y < h; y += 2)
+	{
+		uint8_t *dest_even = dest + y * dst_pitch;
+		uint8_t *dest_odd = dest_even + dst_pitch;
+		uint8_t *y_p_even = y_p + y * y_pitch;
+		uint8_t *y_p_odd = y_p_even + y_pitch;
+		uint8_t *u_row = u_p + (y / 2) * uv_pitch;
+		uint8_t *v_row = v_p + (y / 2) * uv_pitch;
+
+		for (x = 0; x < w; x += 32)
+		{
+			__m128i u, v;
+			__m256i uv, ye, yo, lo, hi;
+
+			/* overlap the final 32-pixel block to process the width exactly */
+			if (x > w - 32)
+				x = w - 32;
+
+			u = _mm_loadu_si128((__m128i *)(u_row + x / 2));
+			v = _mm_loadu_si128((__m128i *)(v_row + x / 2));
+			uv = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(u, v)),
+					_mm_unpackhi_epi8(u, v), 1);
+			ye = _mm256_loadu_si256((__m256i *)(y_p_even + x));
+			yo = _mm256_loadu_si256((__m256i *)(y_p_odd + x));
+
+			lo = _mm256_unpacklo_epi8(uv, ye);
+			hi = _mm256_unpackhi_epi8(uv, ye);
+			_mm256_storeu_si256((__m256i *)(dest_even + x * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i *)(dest_even + x * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+
+			lo = _mm256_unpacklo_epi8(uv, yo);
+			hi = _mm256_unpackhi_epi8(uv, yo);
+			_mm256_storeu_si256((__m256i *)(dest_odd + x * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i *)(dest_odd + x * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+	}
+}
+
+/* average of the even and odd bytes of a, as 16-bit lanes */
+__attribute__((target("sse2")))
+static inline __m128i pair_avg_sse2(__m128i a)
+{
+	return _mm_avg_epu16(_mm_and_si128(a, _mm_set1_epi16(0xff)), _mm_srli_epi16(a, 8));
+}
+
+/* the 32 bytes of a and b reduced to 16 averages of neighbouring pairs */
+__attribute__((target("sse2")))
+static inline __m128i halve_sse2(__m128i a, __m128i b)
+{
+	return _mm_packus_epi16(pair_avg_sse2(a), pair_avg_sse2(b));
+}
+
+/* vertical average of 16 bytes over the given number of rows */
+__attribute__((target("sse2")))
+static inline __m128i rows_avg_sse2(uint8_t *p, int pitch, int rows)
+{
+	__m128i a = _mm_avg_epu8(_mm_loadu_si128((__m128i *)p),
+			_mm_loadu_si128((__m128i *)(p + pitch)));
+
+	if (rows == 4)
+		a = _mm_avg_epu8(a, _mm_avg_epu8(_mm_loadu_si128((__m128i *)(p + 2 * pitch)),
+					_mm_loadu_si128((__m128i *)(p + 3 * pitch))));
+	return a;
+}
+
+/* box downscale, 16 destination pixels per iteration */
+__attribute__((target("sse2")))
+static void uv12_to_uyvy_box_sse2(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	if (w < 16)
+	{
+		uv12_to_uyvy_box_c(factor, w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+		return;
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		uint8_t *d = dest + y * dst_pitch;
+		uint8_t *y_row = y_p + y * factor * y_pitch;
+		uint8_t *u_row = u_p + y * factor / 2 * uv_pitch;
+		uint8_t *v_row = v_p + y * factor / 2 * uv_pitch;
+
+		for (x = 0; x < w; x += 16)
+		{
+			__m128i yy, u, v, uv;
+
+			/* overlap the final 16-pixel block to process the width exactly */
+			if (x > w - 16)
+				x = w - 16;
+
+			_mm_prefetch((const char *)(y_row + x * factor + PREFETCH_AHEAD), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(y_row + y_pitch + x * factor + PREFETCH_AHEAD), _MM_HINT_NTA);
+
+			if (factor == 2)
+			{
+				yy = halve_sse2(rows_avg_sse2(y_row + x * 2, y_pitch, 2),
+						rows_avg_sse2(y_row + x * 2 + 16, y_pitch, 2));
+				u = pair_avg_sse2(_mm_loadu_si128((__m128i *)(u_row + x)));
+				v = pair_avg_sse2(_mm_loadu_si128((__m128i *)(v_row + x)));
+			}
+			else
+			{
+				uint8_t *p = y_row + x * 4;
+
+				yy = halve_sse2(halve_sse2(rows_avg_sse2(p, y_pitch, 4),
+							rows_avg_sse2(p + 16, y_pitch, 4)),
+						halve_sse2(rows_avg_sse2(p + 32, y_pitch, 4),
+							rows_avg_sse2(p + 48, y_pitch, 4)));
+				u = pair_avg_sse2(halve_sse2(rows_avg_sse2(u_row + x * 2, uv_pitch, 2),
+							rows_avg_sse2(u_row + x * 2 + 16, uv_pitch, 2)));
+				v = pair_avg_sse2(halve_sse2(rows_avg_sse2(v_row + x * 2, uv_pitch, 2),
+							rows_avg_sse2(v_row + x * 2 + 16, uv_pitch, 2)));
+			}
+
+			/* U in the low half, V in the high half, then interleaved */
+			uv = _mm_packus_epi16(u, v);
+			uv = _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 8));
+
+			_mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi8(uv, yy));
+			_mm_storeu_si128((__m128i *)(d + x * 2 + 16), _mm_unpackhi_epi8(uv, yy));
+		}
+	}
+}
+
+/*
+ * Write-combining friendly variants: each destination row is written front
+ * to back in whole 64-byte lines with non-temporal stores, so the frame
+ * bypasses the cache and a row never competes with its neighbour for the
+ * write-combining buffers. Rows that are not aligned for streaming fall back
+ * to plain stores, as does the overlapping final block of a row. The sources
+ * are prefetched ahead of the loads.
+ */
+__attribute__((target("sse2")))
+static inline void store_sse2(uint8_t *p, __m128i v, int nt)
+{
+	if (nt)
+		_mm_stream_si128((__m128i *)p, v);
+	else
+		_mm_storeu_si128((__m128i *)p, v);
+}
+
+__attribute__((target("sse2")))
+static void uv12_to_uyvy_sse2_nt(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	if (w < 32)
+	{
+		uv12_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+		return;
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		uint8_t *d = dest + y * dst_pitch;
+		uint8_t *y_row = y_p + y * y_pitch;
+		uint8_t *u_row = u_p + (y / 2) * uv_pitch;
+		uint8_t *v_row = v_p + (y / 2) * uv_pitch;
+		int nt = !((uintptr_t)d & 15);
+
+		for (x = 0; x < w; x += 32)
+		{
+			__m128i u, v, uv_lo, uv_hi, y0, y1;
+
+			/* overlap the final 32-pixel block to process the width exactly */
+			if (x > w - 32)
+			{
+				x = w - 32;
+				nt = 0;
+			}
+
+			_mm_prefetch((const char *)(y_row + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(u_row + x / 2 + PREFETCH_AHEAD / 2), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(v_row + x / 2 + PREFETCH_AHEAD / 2), _MM_HINT_NTA);
+
+			u = _mm_loadu_si128((__m128i *)(u_row + x / 2));
+			v = _mm_loadu_si128((__m128i *)(v_row + x / 2));
+			uv_lo = _mm_unpacklo_epi8(u, v);
+			uv_hi = _mm_unpackhi_epi8(u, v);
+			y0 = _mm_loadu_si128((__m128i *)(y_row + x));
+			y1 = _mm_loadu_si128((__m128i *)(y_row + x + 16));
+
+			store_sse2(d + x * 2, _mm_unpacklo_epi8(uv_lo, y0), nt);
+			store_sse2(d + x * 2 + 16, _mm_unpackhi_epi8(uv_lo, y0), nt);
+			store_sse2(d + x * 2 + 32, _mm_unpacklo_epi8(uv_hi, y1), nt);
+			store_sse2(d + x * 2 + 48, _mm_unpackhi_epi8(uv_hi, y1), nt);
+		}
+	}
+
+	_mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void nv_to_uyvy_sse2_nt(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest, int swap)
+{
+	int x, y;
+
+	if (w < 32)
+	{
+		nv_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, swap);
+		return;
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		uint8_t *d = dest + y * dst_pitch;
+		uint8_t *y_row = y_p + y * y_pitch;
+		uint8_t *uv_row = uv_p + (y / 2) * uv_pitch;
+		int nt = !((uintptr_t)d & 15);
+
+		for (x = 0; x < w; x += 32)
+		{
+			__m128i uv0, uv1, y0, y1;
+
+			/* overlap the final 32-pixel block to process the width exactly */
+			if (x > w - 32)
+			{
+				x = w - 32;
+				nt = 0;
+			}
+
+			_mm_prefetch((const char *)(y_row + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(uv_row + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+
+			uv0 = _mm_loadu_si128((__m128i *)(uv_row + x));
+			uv1 = _mm_loadu_si128((__m128i *)(uv_row + x + 16));
+			if (swap)
+			{
+				uv0 = _mm_or_si128(_mm_slli_epi16(uv0, 8), _mm_srli_epi16(uv0, 8));
+				uv1 = _mm_or_si128(_mm_slli_epi16(uv1, 8), _mm_srli_epi16(uv1, 8));
+			}
+			y0 = _mm_loadu_si128((__m128i *)(y_row + x));
+			y1 = _mm_loadu_si128((__m128i *)(y_row + x + 16));
+
+			store_sse2(d + x * 2, _mm_unpacklo_epi8(uv0, y0), nt);
+			store_sse2(d + x * 2 + 16, _mm_unpackhi_epi8(uv0, y0), nt);
+			store_sse2(d + x * 2 + 32, _mm_unpacklo_epi8(uv1, y1), nt);
+			store_sse2(d + x * 2 + 48, _mm_unpackhi_epi8(uv1, y1), nt);
+		}
+	}
+
+	_mm_sfence();
+}
+
+static void nv12_to_uyvy_sse2_nt(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	nv_to_uyvy_sse2_nt(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 0);
+}
+
+static void nv21_to_uyvy_sse2_nt(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	nv_to_uyvy_sse2_nt(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest, 1);
+}
+
+__attribute__((target("sse2")))
+static void packed_line_copy_sse2_nt(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+{
+	int i, x;
+	int len = w * 2;
+
+	for (i = 0; i < h; i++)
+	{
+		uint8_t *s = src + i * src_stride;
+		uint8_t *d = dest + i * dst_stride;
+
+		/* plain stores up to the first aligned line */
+		x = -(uintptr_t)d & 15;
+		if (x > len)
+			x = len;
+		memcpy(d, s, x);
+
+		for (; x + 64 <= len; x += 64)
+		{
+			__m128i a, b, c, e;
+
+			_mm_prefetch((const char *)(s + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+			a = _mm_loadu_si128((__m128i *)(s + x));
+			b = _mm_loadu_si128((__m128i *)(s + x + 16));
+			c = _mm_loadu_si128((__m128i *)(s + x + 32));
+			e = _mm_loadu_si128((__m128i *)(s + x + 48));
+			_mm_stream_si128((__m128i *)(d + x), a);
+			_mm_stream_si128((__m128i *)(d + x + 16), b);
+			_mm_stream_si128((__m128i *)(d + x + 32), c);
+			_mm_stream_si128((__m128i *)(d + x + 48), e);
+		}
+		memcpy(d + x, s + x, len - x);
+	}
+
+	_mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static inline void store_avx2(uint8_t *p, __m256i v, int nt)
+{
+	if (nt)
+		_mm256_stream_si256((__m256i *)p, v);
+	else
+		_mm256_storeu_si256((__m256i *)p, v);
+}
+
+__attribute__((target("avx2")))
+static void uv12_to_uyvy_avx2_nt(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int x, y;
+
+	if (w < 32)
+	{
+		uv12_to_uyvy_sse2(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+		return;
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		uint8_t *d = dest + y * dst_pitch;
+		uint8_t *y_row = y_p + y * y_pitch;
+		uint8_t *u_row = u_p + (y / 2) * uv_pitch;
+		uint8_t *v_row = v_p + (y / 2) * uv_pitch;
+		int nt = !((uintptr_t)d & 31);
+
+		for (x = 0; x < w; x += 32)
+		{
+			__m128i u, v;
+			__m256i uv, yy, lo, hi;
+
+			/* overlap the final 32-pixel block to process the width exactly */
+			if (x > w - 32)
+			{
+				x = w - 32;
+				nt = 0;
+			}
+
+			_mm_prefetch((const char *)(y_row + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(u_row + x / 2 + PREFETCH_AHEAD / 2), _MM_HINT_NTA);
+			_mm_prefetch((const char *)(v_row + x / 2 + PREFETCH_AHEAD / 2), _MM_HINT_NTA);
+
+			u = _mm_loadu_si128((__m128i *)(u_row + x / 2));
+			v = _mm_loadu_si128((__m128i *)(v_row + x / 2));
+			uv = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(u, v)),
+					_mm_unpackhi_epi8(u, v), 1);
+			yy = _mm256_loadu_si256((__m256i *)(y_row + x));
+
+			lo = _mm256_unpacklo_epi8(uv, yy);
+			hi = _mm256_unpackhi_epi8(uv, yy);
+			store_avx2(d + x * 2, _mm256_permute2x128_si256(lo, hi, 0x20), nt);
+			store_avx2(d + x * 2 + 32, _mm256_permute2x128_si256(lo, hi, 0x31), nt);
+		}
+	}
+
+	_mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void packed_line_copy_avx2_nt(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+{
+	int i, x;
+	int len = w * 2;
+
+	for (i = 0; i < h; i++)
+	{
+		uint8_t *s = src + i * src_stride;
+		uint8_t *d = dest + i * dst_stride;
+
+		/* plain stores up to the first aligned line */
+		x = -(uintptr_t)d & 31;
+		if (x > len)
+			x = len;
+		memcpy(d, s, x);
+
+		for (; x + 64 <= len; x += 64)
+		{
+			__m256i a, b;
+
+			_mm_prefetch((const char *)(s + x + PREFETCH_AHEAD), _MM_HINT_NTA);
+			a = _mm256_loadu_si256((__m256i *)(s + x));
+			b = _mm256_loadu_si256((__m256i *)(s + x + 32));
+			_mm256_stream_si256((__m256i *)(d + x), a);
+			_mm256_stream_si256((__m256i *)(d + x + 32), b);
+		}
+		memcpy(d + x, s + x, len - x);
+	}
+
+	_mm_sfence();
+}
+
+static int cpu_has_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int cpu_has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/*
+ * The last entry the CPU supports is the default. Entries that stream past
+ * the cache are only picked for destinations in framebuffer memory, which
+ * is write-combined on the devices; destinations in ordinary memory use
+ * the cached ones, which the bench shows ahead while a frame fits the
+ * cache.
+ */
+static const struct conversion_impl impls[] = {
+	{ "c", NULL, uv12_to_uyvy_c, nv12_to_uyvy_c, nv21_to_uyvy_c, packed_line_copy_c, uv12_to_uyvy_box_c, 0 },
+#ifdef HAVE_NEON
+	{ "neon-wc", NULL, uv12_to_uyvy_neon_wc, nv12_to_uyvy_neon_wc, nv21_to_uyvy_neon_wc, packed_line_copy_neon_wc, uv12_to_uyvy_box_neon, 1 },
+	{ "neon", NULL, uv12_to_uyvy_neon, nv12_to_uyvy_neon, nv21_to_uyvy_neon, packed_line_copy_c, uv12_to_uyvy_box_neon, 0 },
+#endif
+#ifdef HAVE_X86_SIMD
+	{ "sse2-nt", cpu_has_sse2, uv12_to_uyvy_sse2_nt, nv12_to_uyvy_sse2_nt, nv21_to_uyvy_sse2_nt, packed_line_copy_sse2_nt, uv12_to_uyvy_box_sse2, 1 },
+	{ "avx2-nt", cpu_has_avx2, uv12_to_uyvy_avx2_nt, nv12_to_uyvy_sse2_nt, nv21_to_uyvy_sse2_nt, packed_line_copy_avx2_nt, uv12_to_uyvy_box_sse2, 1 },
+	{ "sse2", cpu_has_sse2, uv12_to_uyvy_sse2, nv12_to_uyvy_sse2, nv21_to_uyvy_sse2, packed_line_copy_sse2, uv12_to_uyvy_box_sse2, 0 },
+	{ "avx2", cpu_has_avx2, uv12_to_uyvy_avx2, nv12_to_uyvy_sse2, nv21_to_uyvy_sse2, packed_line_copy_sse2, uv12_to_uyvy_box_sse2, 0 },
+#endif
+};
+
+static const struct conversion_impl *selected, *selected_fb;
+
+int conversion_impl_supported(const struct conversion_impl *impl)
+{
+	return !impl->supported || impl->supported();
+}
+
+const struct conversion_impl *conversion_impl_list(unsigned *count)
+{
+	*count = sizeof(impls) / sizeof(impls[0]);
+	return impls;
+}
+
+/* NULL when the CPU supports no such entry */
+static const struct conversion_impl *pick(const char *name, int write_combining)
+{
+	int i;
+
+	for (i = sizeof(impls) / sizeof(impls[0]) - 1; i >= 0; i--)
+	{
+		if (!conversion_impl_supported(&impls[i]))
+			continue;
+		if (name ? strcmp(name, impls[i].name) : impls[i].write_combining != write_combining)
+			continue;
+		return &impls[i];
+	}
+	return NULL;
+}
+
+/*
+ * Pick the preferred implementation the CPU supports; the
+ * OMAPFB_CONVERSION environment variable forces one by name.
+ */
+const struct conversion_impl *conversion_impl_get(void)
+{
+	const struct conversion_impl *impl = selected;
+
+	if (impl)
+		return impl;
+
+	impl = pick(getenv("OMAPFB_CONVERSION"), 0);
+	if (!impl)
+		impl = &impls[0];
+
+	/* concurrent first callers all pick the same entry */
+	selected = impl;
+	return impl;
+}
+
+const struct conversion_impl *conversion_impl_get_fb(void)
+{
+	const struct conversion_impl *impl = selected_fb;
+
+	if (impl)
+		return impl;
+
+	/* a forced implementation is used for every destination */
+	impl = getenv("OMAPFB_CONVERSION") ? NULL : pick(NULL, 1);
+	if (!impl)
+		impl = conversion_impl_get();
+
+	selected_fb = impl;
+	return impl;
+}
+
+void packed_line_copy(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest)
+{
+	conversion_impl_get()->packed_line_copy(w, h, src_stride, dst_stride, src, dest);
+}
+
+void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	conversion_impl_get()->uv12_to_uyvy(w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+}
+
+void nv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	conversion_impl_get()->nv12_to_uyvy(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest);
+}
+
+void nv21_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest)
+{
+	conversion_impl_get()->nv21_to_uyvy(w, h, y_pitch, uv_pitch, dst_pitch, y_p, uv_p, dest);
+}
+
+void uv12_to_uyvy_box(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	conversion_impl_get()->uv12_to_uyvy_box(factor, w, h, y_pitch, uv_pitch, dst_pitch, y_p, u_p, v_p, dest);
+}
+
+/* destination tile edge, in pixels, for the rotating conversion */
+#define ROTATE_TILE 32
+
+void yuv420_to_uyvy_rotate(int rotation, int mirror, int factor, int w, int h, int first_row, int rows,
+		int y_pitch, int uv_pitch, int uv_step, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest)
+{
+	int out_w = (rotation == 90 || rotation == 270) ? h : w;
+	int end = first_row + rows;
+	/* source position of destination pixel 0,0 and its steps along destination x and y */
+	int sx0, sy0, dxx, dxy, dyx, dyy;
+	int tx, ty, x, y;
+
+	switch (rotation)
+	{
+	case 90:
+		sx0 = 0; sy0 = h - 1;
+		dxx = 0; dyx = -1; dxy = 1; dyy = 0;
+		break;
+	case 180:
+		sx0 = w - 1; sy0 = h - 1;
+		dxx = -1; dyx = 0; dxy = 0; dyy = -1;
+		break;
+	case 270:
+		sx0 = w - 1; sy0 = 0;
+		dxx = 0; dyx = 1; dxy = -1; dyy = 0;
+		break;
+	default:
+		sx0 = 0; sy0 = 0;
+		dxx = 1; dyx = 0; dxy = 0; dyy = 1;
+		break;
+	}
+
+	if (mirror)
+	{
+		sx0 += (out_w - 1) * dxx;
+		sy0 += (out_w - 1) * dyx;
+		dxx = -dxx;
+		dyx = -dyx;
+	}
+
+	/*
+	 * Both pixels of a destination pair are neighbours in the source, and
+	 * with even sizes they share their chroma sample. Working in tiles
+	 * keeps the source lines a tile touches in the cache while it is read
+	 * across its rows.
+	 */
+	for (ty = first_row; ty < end; ty += ROTATE_TILE)
+	{
+		int ty_end = ty + ROTATE_TILE < end ? ty + ROTATE_TILE : end;
+
+		for (tx = 0; tx < out_w; tx += ROTATE_TILE)
+		{
+			int tx_end = tx + ROTATE_TILE < out_w ? tx + ROTATE_TILE : out_w;
+
+			for (y = ty; y < ty_end; y++)
+			{
+				uint8_t *d = dest + (y * out_w + tx) * 2;
+
+				for (x = tx; x < tx_end; x += 2)
+				{
+					int sx = sx0 + x * dxx + y * dxy;
+					int sy = sy0 + x * dyx + y * dyy;
+					int cx = dxx < 0 ? sx + dxx : sx;
+					int cy = dyx < 0 ? sy + dyx : sy;
+					int c, cols, crows;
+
+					if (factor == 1)
+					{
+						c = cy / 2 * uv_pitch + cx / 2 * uv_step;
+						*d++ = u_p[c];
+						*d++ = y_p[sy * y_pitch + sx];
+						*d++ = v_p[c];
+						*d++ = y_p[(sy + dyx) * y_pitch + sx + dxx];
+						continue;
+					}
+
+					/*
+					 * Prescaled: every pixel has chroma of its own, the
+					 * pair averages what both of them cover, as the
+					 * unrotated box downscale does.
+					 */
+					c = cy * factor / 2 * uv_pitch + cx * factor / 2 * uv_step;
+					cols = dxx ? factor : factor / 2;
+					crows = dxx ? factor / 2 : factor;
+					*d++ = box_step_c(u_p + c, uv_pitch, uv_step, cols, crows);
+					*d++ = box_step_c(y_p + (sy * y_pitch + sx) * factor, y_pitch, 1, factor, factor);
+					*d++ = box_step_c(v_p + c, uv_pitch, uv_step, cols, crows);
+					*d++ = box_step_c(y_p + ((sy + dyx) * y_pitch + sx + dxx) * factor, y_pitch, 1, factor, factor);
+				}
+			}
+		}
+	}
+}
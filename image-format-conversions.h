@@ -30,7 +30,44 @@
 void packed_line_copy(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest);
 
 /* Basic C implementation of YV12/I420 to UYVY conversion */
-void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+void uv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+
+/* NV12/NV21 (interleaved chroma plane) to UYVY conversion */
+void nv12_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest);
+void nv21_to_uyvy(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest);
+
+/* YV12/I420 to UYVY with a 2x2 or 4x4 box downscale; w and h are the destination size */
+void uv12_to_uyvy_box(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+
+/*
+ * YV12/I420 or NV12/NV21 to UYVY, box downscaled by factor (1, 2 or 4),
+ * rotated clockwise by 0, 90, 180 or 270 degrees and then optionally
+ * mirrored. w and h are the even source size after the downscale; the
+ * destination is h x w for 90 and 270. Only destination rows first_row
+ * to first_row + rows - 1 are written. uv_step is 1 for separate chroma
+ * planes and 2 for interleaved ones.
+ */
+void yuv420_to_uyvy_rotate(int rotation, int mirror, int factor, int w, int h, int first_row, int rows,
+		int y_pitch, int uv_pitch, int uv_step, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+
+/* Set of kernels for one instruction set; the functions above dispatch to the best one */
+struct conversion_impl {
+	const char *name;
+	int (*supported)(void);
+	void (*uv12_to_uyvy)(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+	void (*nv12_to_uyvy)(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest);
+	void (*nv21_to_uyvy)(int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *uv_p, uint8_t *dest);
+	void (*packed_line_copy)(int w, int h, int src_stride, int dst_stride, uint8_t *src, uint8_t *dest);
+	void (*uv12_to_uyvy_box)(int factor, int w, int h, int y_pitch, int uv_pitch, int dst_pitch, uint8_t *y_p, uint8_t *u_p, uint8_t *v_p, uint8_t *dest);
+	/* stores bypass the cache, for write-combined framebuffer memory */
+	int write_combining;
+};
+
+const struct conversion_impl *conversion_impl_get(void);
+/* the implementation for destinations in framebuffer memory */
+const struct conversion_impl *conversion_impl_get_fb(void);
+const struct conversion_impl *conversion_impl_list(unsigned *count);
+int conversion_impl_supported(const struct conversion_impl *impl);
 
 #endif /* __IMAGE_FORMAT_CONVERSIONS_H__ */
 
@@ -12,27 +12,14 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <stdlib.h>
 
 #include <gst/gst.h>
 
-#ifndef GST_DISABLE_GST_DEBUG
-extern GstDebugCategory *omapfb_debug;
-#endif
+/* longer messages are truncated */
+#define PR_BUFFER_SIZE 512
 
-#ifndef GST_DISABLE_GST_DEBUG
-static inline GstDebugLevel
-log_level_to_gst(unsigned int level)
-{
-	switch (level) {
-	case 0: return GST_LEVEL_ERROR;
-	case 1: return GST_LEVEL_WARNING;
-	case 2:
-	case 3: return GST_LEVEL_INFO;
-	default: return GST_LEVEL_DEBUG;
-	}
-}
-#endif
+/* each message is formatted once, into a buffer of the calling thread */
+static __thread char buffer[PR_BUFFER_SIZE];
 
 void pr_helper(unsigned int level,
 		void *object,
@@ -42,33 +29,24 @@ void pr_helper(unsigned int level,
 		const char *fmt,
 		...)
 {
-	char *tmp;
 	va_list args;
 
 	va_start(args, fmt);
-
-	if (vasprintf(&tmp, fmt, args) < 0)
-		goto leave;
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
 
 	if (level <= 1)
-		g_printerr("%s: %s\n", function, tmp);
+		g_printerr("%s: %s\n", function, buffer);
 	else if (level == 2)
-		g_print("%s:%s(%u): %s\n", file, function, line, tmp);
-#if defined(DEVEL) || defined(DEBUG)
-	else if (level == 3)
-		g_print("%s: %s\n", function, tmp);
-#endif
-#ifdef DEBUG
-	else if (level == 4)
-		g_print("%s:%s(%u): %s\n", file, function, line, tmp);
-#endif
+		g_print("%s:%s(%u): %s\n", file, function, line, buffer);
+	else if (level == 3 && PR_PRINT_LEVEL >= 3)
+		g_print("%s: %s\n", function, buffer);
+	else if (level == 4 && PR_PRINT_LEVEL >= 4)
+		g_print("%s:%s(%u): %s\n", file, function, line, buffer);
 
 #ifndef GST_DISABLE_GST_DEBUG
-	gst_debug_log_valist(omapfb_debug, log_level_to_gst(level), file, function, line, object, fmt, args);
+	if (pr_gst_enabled(level))
+		gst_debug_log(omapfb_debug, pr_gst_level(level), file, function, line,
+				object, "%s", buffer);
 #endif
-
-	free(tmp);
-
-leave:
-	va_end(args);
 }
@@ -11,8 +11,59 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdbool.h>
+
+#include <gst/gst.h>
+
 /* #define DEBUG */
 
+/* highest level that is also printed to the console */
+#if defined(DEBUG)
+#define PR_PRINT_LEVEL 4
+#elif defined(DEVEL)
+#define PR_PRINT_LEVEL 3
+#else
+#define PR_PRINT_LEVEL 2
+#endif
+
+#ifndef GST_DISABLE_GST_DEBUG
+extern GstDebugCategory *omapfb_debug;
+
+static inline GstDebugLevel
+pr_gst_level(unsigned int level)
+{
+	switch (level) {
+	case 0: return GST_LEVEL_ERROR;
+	case 1: return GST_LEVEL_WARNING;
+	case 2:
+	case 3: return GST_LEVEL_INFO;
+	default: return GST_LEVEL_DEBUG;
+	}
+}
+#endif
+
+/* whether the GStreamer log takes messages of this level right now */
+static inline bool
+pr_gst_enabled(unsigned int level)
+{
+#ifndef GST_DISABLE_GST_DEBUG
+	return pr_gst_level(level) <= __gst_debug_min && omapfb_debug &&
+		pr_gst_level(level) <= gst_debug_category_get_threshold(omapfb_debug);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Checked by the macros before the arguments are evaluated, so a message
+ * that goes nowhere costs a couple of comparisons.
+ */
+static inline bool
+pr_enabled(unsigned int level)
+{
+	return level <= PR_PRINT_LEVEL || pr_gst_enabled(level);
+}
+
 void pr_helper(unsigned int level,
 		void *object,
 		const char *file,
@@ -21,7 +72,8 @@ void pr_helper(unsigned int level,
 		const char *fmt,
 		...) __attribute__((format(printf, 6, 7)));
 
-#define pr_base(level, object, ...) pr_helper(level, object, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define pr_base(level, object, ...) \
+	({ if (pr_enabled(level)) pr_helper(level, object, __FILE__, __func__, __LINE__, __VA_ARGS__); })
 
 #define pr_err(object, ...) pr_base(0, object, __VA_ARGS__)
 #define pr_warning(object, ...) pr_base(1, object, __VA_ARGS__)
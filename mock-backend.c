@@ -0,0 +1,450 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * In-memory omapfb emulation.
+ *
+ * /dev/fb0 is the display and /dev/fb1.. the video overlays. Overlay memory
+ * is anonymous memory, plane and screen state live in the device structs and
+ * vsync is a periodic timerfd, which also serves as the file descriptor of
+ * the open device.
+ *
+ * Environment:
+ *   OMAPFB_MOCK_DISPLAY   display resolution, "800x480" by default
+ *   OMAPFB_MOCK_OVERLAYS  number of video overlays, 2 by default
+ *   OMAPFB_MOCK_REFRESH   vsync rate in Hz, 60 by default
+ *   OMAPFB_MOCK_YUV420    accept OMAPFB_COLOR_YUV420 when set to 1
+ *   OMAPFB_MOCK_DOWNSCALE largest plane downscale accepted, 2 by default;
+ *                         a 1920x1080 source rotated into a portrait plane
+ *                         is refused unless the sink prescales it
+ *   OMAPFB_MOCK_STATS     print per-device statistics on close when set
+ */
+
+#include "backend.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <linux/fb.h>
+#include <linux/omapfb.h>
+
+#define MAX_DEVICES 8
+#define MAX_HANDLES 32
+
+struct mock_device {
+	struct fb_var_screeninfo var;
+	struct omapfb_plane_info plane;
+	struct omapfb_mem_info mem;
+	void *memory;
+	size_t memory_size;
+	unsigned maps;
+	int update_mode;
+
+	unsigned long long updates;
+	unsigned long long update_bytes;
+	unsigned long long pans;
+	unsigned long long vsyncs;
+};
+
+struct mock_handle {
+	int fd;
+	struct mock_device *dev;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_device devices[MAX_DEVICES];
+static unsigned ndevices;
+static struct mock_handle handles[MAX_HANDLES];
+static unsigned refresh = 60;
+static bool yuv420;
+static unsigned max_downscale = 2;
+
+static unsigned
+env_uint(const char *name, unsigned def)
+{
+	const char *value = getenv(name);
+
+	return value ? strtoul(value, NULL, 0) : def;
+}
+
+/* must be called with the lock held */
+static void
+init_devices(void)
+{
+	unsigned xres = 800, yres = 480, i;
+	const char *display;
+
+	if (ndevices)
+		return;
+
+	display = getenv("OMAPFB_MOCK_DISPLAY");
+	if (display)
+		sscanf(display, "%ux%u", &xres, &yres);
+
+	refresh = env_uint("OMAPFB_MOCK_REFRESH", 60);
+	if (!refresh)
+		refresh = 60;
+	yuv420 = env_uint("OMAPFB_MOCK_YUV420", 0);
+	max_downscale = env_uint("OMAPFB_MOCK_DOWNSCALE", 2);
+	if (!max_downscale)
+		max_downscale = 2;
+
+	ndevices = 1 + env_uint("OMAPFB_MOCK_OVERLAYS", 2);
+	if (ndevices > MAX_DEVICES)
+		ndevices = MAX_DEVICES;
+
+	for (i = 0; i < ndevices; i++) {
+		struct mock_device *dev = &devices[i];
+
+		memset(dev, 0, sizeof(*dev));
+		dev->var.xres = dev->var.xres_virtual = xres;
+		dev->var.yres = dev->var.yres_virtual = yres;
+		dev->var.bits_per_pixel = 16;
+		dev->update_mode = OMAPFB_AUTO_UPDATE;
+		if (i == 0) {
+			dev->plane.enabled = 1;
+			dev->plane.out_width = xres;
+			dev->plane.out_height = yres;
+		}
+	}
+}
+
+/* must be called with the lock held */
+static struct mock_device *
+lookup(int fd)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (handles[i].dev && handles[i].fd == fd)
+			return handles[i].dev;
+	}
+
+	return NULL;
+}
+
+static int
+mock_open(const char *path, int flags)
+{
+	struct itimerspec period;
+	unsigned index, i;
+	int fd;
+
+	if (sscanf(path, "/dev/fb%u", &index) != 1) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	init_devices();
+
+	if (index >= ndevices) {
+		pthread_mutex_unlock(&lock);
+		errno = ENOENT;
+		return -1;
+	}
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!handles[i].dev)
+			break;
+	}
+	if (i == MAX_HANDLES) {
+		pthread_mutex_unlock(&lock);
+		errno = EMFILE;
+		return -1;
+	}
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	period.it_interval.tv_sec = 0;
+	period.it_interval.tv_nsec = 1000000000 / refresh;
+	period.it_value = period.it_interval;
+	timerfd_settime(fd, 0, &period, NULL);
+
+	handles[i].fd = fd;
+	handles[i].dev = &devices[index];
+	pthread_mutex_unlock(&lock);
+
+	return fd;
+}
+
+static int
+mock_close(int fd)
+{
+	struct mock_device *dev = NULL;
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (handles[i].dev && handles[i].fd == fd) {
+			dev = handles[i].dev;
+			handles[i].dev = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!dev) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (getenv("OMAPFB_MOCK_STATS") && dev->updates + dev->pans) {
+		fprintf(stderr, "omapfb-mock: fb%u: %llu updates, %llu bytes/update, %llu pans, %llu vsyncs\n",
+				(unsigned) (dev - devices), dev->updates,
+				dev->updates ? dev->update_bytes / dev->updates : 0,
+				dev->pans, dev->vsyncs);
+	}
+
+	return close(fd);
+}
+
+static unsigned
+bits_per_pixel(const struct fb_var_screeninfo *var)
+{
+	switch (var->nonstd) {
+	case OMAPFB_COLOR_YUV420:
+		return 12;
+	case OMAPFB_COLOR_YUV422:
+	case OMAPFB_COLOR_YUY422:
+		return 16;
+	default:
+		return var->bits_per_pixel;
+	}
+}
+
+/* must be called with the lock held */
+static int
+set_var(struct mock_device *dev, struct fb_var_screeninfo *var)
+{
+	size_t needed;
+
+	switch (var->nonstd) {
+	case 0:
+	case OMAPFB_COLOR_YUV422:
+	case OMAPFB_COLOR_YUY422:
+		break;
+	case OMAPFB_COLOR_YUV420:
+		if (yuv420)
+			break;
+		/* fall through */
+	default:
+		return -EINVAL;
+	}
+
+	if (var->nonstd == 0 && var->bits_per_pixel != 16 && var->bits_per_pixel != 32)
+		return -EINVAL;
+
+	if (var->xres_virtual < var->xres)
+		var->xres_virtual = var->xres;
+	if (var->yres_virtual < var->yres)
+		var->yres_virtual = var->yres;
+
+	needed = (size_t) var->xres_virtual * var->yres_virtual * bits_per_pixel(var) / 8;
+	if (dev != devices && needed > dev->memory_size)
+		return -EINVAL;
+
+	dev->var = *var;
+	return 0;
+}
+
+/* must be called with the lock held */
+static int
+setup_mem(struct mock_device *dev, const struct omapfb_mem_info *mem)
+{
+	void *memory = NULL;
+
+	if (mem->size == dev->memory_size) {
+		dev->mem = *mem;
+		return 0;
+	}
+
+	/* like omapfb, memory that is mapped can't be reallocated */
+	if (dev->maps)
+		return -EBUSY;
+
+	if (mem->size) {
+		memory = mmap(NULL, mem->size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return -ENOMEM;
+	}
+
+	if (dev->memory)
+		munmap(dev->memory, dev->memory_size);
+
+	dev->memory = memory;
+	dev->memory_size = mem->size;
+	dev->mem = *mem;
+	return 0;
+}
+
+static int
+wait_vsync(int fd, struct mock_device *dev)
+{
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return -1;
+
+	pthread_mutex_lock(&lock);
+	dev->vsyncs++;
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static int
+mock_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct mock_device *dev;
+	int r = 0;
+
+	pthread_mutex_lock(&lock);
+	dev = lookup(fd);
+	if (!dev) {
+		pthread_mutex_unlock(&lock);
+		errno = EBADF;
+		return -1;
+	}
+
+	switch (request) {
+	case FBIOGET_VSCREENINFO:
+		*(struct fb_var_screeninfo *) arg = dev->var;
+		break;
+	case FBIOPUT_VSCREENINFO:
+		r = set_var(dev, arg);
+		break;
+	case FBIOPAN_DISPLAY: {
+		struct fb_var_screeninfo *var = arg;
+
+		if (var->xoffset + dev->var.xres > dev->var.xres_virtual ||
+				var->yoffset + dev->var.yres > dev->var.yres_virtual) {
+			r = -EINVAL;
+			break;
+		}
+		dev->var.xoffset = var->xoffset;
+		dev->var.yoffset = var->yoffset;
+		dev->pans++;
+		break;
+	}
+	case OMAPFB_QUERY_PLANE:
+		*(struct omapfb_plane_info *) arg = dev->plane;
+		break;
+	case OMAPFB_SETUP_PLANE: {
+		struct omapfb_plane_info *plane = arg;
+
+		if (plane->enabled &&
+				(plane->pos_x + plane->out_width > devices[0].var.xres ||
+				 plane->pos_y + plane->out_height > devices[0].var.yres)) {
+			r = -EINVAL;
+			break;
+		}
+		/* the DSS scaler can't shrink the overlay's frame any further */
+		if (plane->enabled &&
+				(dev->var.xres > plane->out_width * max_downscale ||
+				 dev->var.yres > plane->out_height * max_downscale)) {
+			r = -EINVAL;
+			break;
+		}
+		dev->plane = *plane;
+		break;
+	}
+	case OMAPFB_SETUP_MEM:
+		r = setup_mem(dev, arg);
+		break;
+	case OMAPFB_SET_UPDATE_MODE:
+		dev->update_mode = *(int *) arg;
+		break;
+	case OMAPFB_UPDATE_WINDOW: {
+		struct omapfb_update_window *win = arg;
+
+		/* the panel is fed in the display's pixel format */
+		dev->updates++;
+		dev->update_bytes += (unsigned long long) win->width * win->height *
+			devices[0].var.bits_per_pixel / 8;
+		break;
+	}
+	case OMAPFB_WAITFORVSYNC:
+	case OMAPFB_WAITFORGO:
+		pthread_mutex_unlock(&lock);
+		return wait_vsync(fd, dev);
+	default:
+		r = -ENOTTY;
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (r) {
+		errno = -r;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *
+mock_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	struct mock_device *dev;
+	void *memory = MAP_FAILED;
+
+	pthread_mutex_lock(&lock);
+	dev = lookup(fd);
+	if (dev && dev->memory && offset + length <= dev->memory_size) {
+		memory = (char *) dev->memory + offset;
+		dev->maps++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (memory == MAP_FAILED)
+		errno = EINVAL;
+
+	return memory;
+}
+
+static int
+mock_munmap(void *addr, size_t length)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < ndevices; i++) {
+		struct mock_device *dev = &devices[i];
+		char *start = dev->memory;
+
+		if (dev->maps && (char *) addr >= start && (char *) addr < start + dev->memory_size) {
+			dev->maps--;
+			pthread_mutex_unlock(&lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	errno = EINVAL;
+	return -1;
+}
+
+const struct omapfb_backend omapfb_mock_backend = {
+	.name = "mock",
+	.open = mock_open,
+	.close = mock_close,
+	.ioctl = mock_ioctl,
+	.mmap = mock_mmap,
+	.munmap = mock_munmap,
+};
@@ -0,0 +1,356 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "mosaic.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include <linux/fb.h>
+#include <linux/omapfb.h>
+
+#include "log.h"
+#include "overlay-alloc.h"
+
+struct mosaic {
+	struct mosaic *next;
+	char *name;
+	unsigned users;
+
+	const struct omapfb_backend *backend;
+	int devid;
+	int fd;
+	struct omapfb_plane_info plane_info;
+	uint8_t *canvas;
+	size_t size;
+	unsigned width, height, pitch;
+	bool manual_update;
+
+	/* damage not pushed yet, x1 == 0 when there is none */
+	GMutex lock;
+	GCond cond;
+	GThread *thread;
+	bool running;
+	unsigned x0, y0, x1, y1;
+};
+
+static GMutex groups_lock;
+static struct mosaic *groups;
+
+/* must be called with groups_lock held */
+static struct mosaic *
+find_group(const char *name)
+{
+	struct mosaic *m;
+
+	for (m = groups; m; m = m->next) {
+		if (!strcmp(m->name, name))
+			return m;
+	}
+
+	return NULL;
+}
+
+/*
+ * Push the damage to the display, once per refresh: waiting for GO collects
+ * whatever the members drew while the previous update went out.
+ */
+static gpointer
+update_loop(gpointer data)
+{
+	struct mosaic *m = data;
+	struct omapfb_update_window update_window;
+
+	g_mutex_lock(&m->lock);
+	while (m->running) {
+		if (!m->x1) {
+			g_cond_wait(&m->cond, &m->lock);
+			continue;
+		}
+		g_mutex_unlock(&m->lock);
+
+		if (m->backend->ioctl(m->fd, OMAPFB_WAITFORGO, NULL))
+			pr_debug(NULL, "could not wait for go");
+
+		g_mutex_lock(&m->lock);
+		memset(&update_window, 0, sizeof(update_window));
+		update_window.x = update_window.out_x = m->x0;
+		update_window.y = update_window.out_y = m->y0;
+		update_window.width = update_window.out_width = m->x1 - m->x0;
+		update_window.height = update_window.out_height = m->y1 - m->y0;
+		m->x0 = m->y0 = m->x1 = m->y1 = 0;
+		g_mutex_unlock(&m->lock);
+
+		if (m->backend->ioctl(m->fd, OMAPFB_UPDATE_WINDOW, &update_window))
+			pr_debug(NULL, "could not update window");
+
+		g_mutex_lock(&m->lock);
+	}
+	g_mutex_unlock(&m->lock);
+
+	return NULL;
+}
+
+static void
+destroy(struct mosaic *m)
+{
+	if (m->thread) {
+		g_mutex_lock(&m->lock);
+		m->running = false;
+		g_cond_signal(&m->cond);
+		g_mutex_unlock(&m->lock);
+		g_thread_join(m->thread);
+	}
+
+	if (m->plane_info.enabled) {
+		m->plane_info.enabled = 0;
+		if (m->backend->ioctl(m->fd, OMAPFB_SETUP_PLANE, &m->plane_info))
+			pr_err(NULL, "could not disable plane");
+	}
+
+	if (m->canvas && m->backend->munmap(m->canvas, m->size))
+		pr_err(NULL, "could not unmap %s", strerror(errno));
+
+	if (m->fd >= 0)
+		m->backend->close(m->fd);
+	if (m->devid >= 0)
+		overlay_release(m->devid);
+
+	g_mutex_clear(&m->lock);
+	g_cond_clear(&m->cond);
+	g_free(m->name);
+	g_free(m);
+}
+
+static struct mosaic *
+create(const char *name, const struct omapfb_backend *backend, int timeout_ms,
+		unsigned width, unsigned height)
+{
+	struct mosaic *m;
+	struct fb_var_screeninfo info;
+	struct omapfb_mem_info mem_info;
+	char dev[20];
+	int update_mode;
+
+	m = g_new0(struct mosaic, 1);
+	m->name = g_strdup(name);
+	m->backend = backend;
+	m->fd = -1;
+	m->width = width & ~1;
+	m->height = height;
+	m->pitch = m->width * 2;
+	m->size = m->pitch * m->height;
+	g_mutex_init(&m->lock);
+	g_cond_init(&m->cond);
+
+	m->devid = overlay_acquire(backend, timeout_ms);
+	if (m->devid < 0) {
+		pr_err(NULL, "no free video overlay for mosaic %s", name);
+		goto fail;
+	}
+	snprintf(dev, sizeof(dev), "/dev/fb%d", m->devid);
+
+	m->fd = backend->open(dev, O_RDWR);
+	if (m->fd == -1) {
+		pr_err(NULL, "could not open %s", dev);
+		goto fail;
+	}
+
+	if (backend->ioctl(m->fd, FBIOGET_VSCREENINFO, &info) ||
+			backend->ioctl(m->fd, OMAPFB_QUERY_PLANE, &m->plane_info)) {
+		pr_err(NULL, "could not query %s", dev);
+		goto fail;
+	}
+
+	m->plane_info.enabled = 0;
+	if (backend->ioctl(m->fd, OMAPFB_SETUP_PLANE, &m->plane_info)) {
+		pr_err(NULL, "could not disable plane");
+		goto fail;
+	}
+
+	if (!overlay_reserve(m->devid, m->size)) {
+		pr_err(NULL, "%zu bytes of overlay memory exceed the budget", m->size);
+		goto fail;
+	}
+
+	memset(&mem_info, 0, sizeof(mem_info));
+	mem_info.type = OMAPFB_MEMTYPE_SDRAM;
+	mem_info.size = m->size;
+	if (backend->ioctl(m->fd, OMAPFB_SETUP_MEM, &mem_info)) {
+		pr_err(NULL, "could not setup memory for a %ux%u mosaic", m->width, m->height);
+		goto fail;
+	}
+
+	m->canvas = backend->mmap(NULL, m->size, PROT_WRITE, MAP_SHARED, m->fd, 0);
+	if (m->canvas == MAP_FAILED) {
+		m->canvas = NULL;
+		pr_err(NULL, "memory map failed");
+		goto fail;
+	}
+
+	info.xres = info.xres_virtual = m->width;
+	info.yres = info.yres_virtual = m->height;
+	info.xoffset = info.yoffset = 0;
+	info.nonstd = OMAPFB_COLOR_YUV422;
+	info.bits_per_pixel = 16;
+	if (backend->ioctl(m->fd, FBIOPUT_VSCREENINFO, &info)) {
+		pr_err(NULL, "could not set screen info");
+		goto fail;
+	}
+
+	mosaic_clear(m, 0, 0, m->width, m->height);
+
+	m->plane_info.enabled = 1;
+	m->plane_info.mirror = 0;
+	m->plane_info.pos_x = 0;
+	m->plane_info.pos_y = 0;
+	m->plane_info.out_width = m->width;
+	m->plane_info.out_height = m->height;
+	if (backend->ioctl(m->fd, OMAPFB_SETUP_PLANE, &m->plane_info)) {
+		m->plane_info.enabled = 0;
+		pr_err(NULL, "could not setup plane");
+		goto fail;
+	}
+
+	update_mode = OMAPFB_MANUAL_UPDATE;
+	backend->ioctl(m->fd, OMAPFB_SET_UPDATE_MODE, &update_mode);
+	m->manual_update = (update_mode == OMAPFB_MANUAL_UPDATE);
+
+	if (m->manual_update) {
+		m->running = true;
+		m->thread = g_thread_try_new("omapfb-mosaic", update_loop, m, NULL);
+		if (!m->thread) {
+			m->running = false;
+			pr_err(NULL, "could not create mosaic update thread");
+			goto fail;
+		}
+		mosaic_damage(m, 0, 0, m->width, m->height);
+	}
+
+	pr_info(NULL, "mosaic %s: %ux%u on %s", name, m->width, m->height, dev);
+	return m;
+
+fail:
+	destroy(m);
+	return NULL;
+}
+
+struct mosaic *
+mosaic_join(const char *name, const struct omapfb_backend *backend,
+		int timeout_ms, unsigned width, unsigned height)
+{
+	struct mosaic *m, *other;
+
+	g_mutex_lock(&groups_lock);
+	m = find_group(name);
+	if (m)
+		m->users++;
+	g_mutex_unlock(&groups_lock);
+
+	if (m)
+		return m;
+
+	/* outside the lock, acquiring the overlay may wait for another group to go */
+	m = create(name, backend, timeout_ms, width, height);
+	if (!m)
+		return NULL;
+
+	g_mutex_lock(&groups_lock);
+	other = find_group(name);
+	if (other) {
+		other->users++;
+	} else {
+		m->users = 1;
+		m->next = groups;
+		groups = m;
+	}
+	g_mutex_unlock(&groups_lock);
+
+	/* another member set the group up meanwhile */
+	if (other) {
+		destroy(m);
+		return other;
+	}
+
+	return m;
+}
+
+void
+mosaic_leave(struct mosaic *mosaic)
+{
+	struct mosaic **p;
+
+	g_mutex_lock(&groups_lock);
+	if (--mosaic->users) {
+		g_mutex_unlock(&groups_lock);
+		return;
+	}
+	for (p = &groups; *p != mosaic; p = &(*p)->next)
+		;
+	*p = mosaic->next;
+	g_mutex_unlock(&groups_lock);
+
+	pr_info(NULL, "mosaic %s: closed", mosaic->name);
+	destroy(mosaic);
+}
+
+uint8_t *
+mosaic_canvas(struct mosaic *mosaic, unsigned *width, unsigned *height, unsigned *pitch)
+{
+	*width = mosaic->width;
+	*height = mosaic->height;
+	*pitch = mosaic->pitch;
+	return mosaic->canvas;
+}
+
+void
+mosaic_clear(struct mosaic *mosaic, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	static const uint8_t black[4] = { 0x80, 0x10, 0x80, 0x10 };
+	uint8_t *row;
+	unsigned i, j;
+
+	x &= ~1;
+	w &= ~1;
+	if (!w || !h)
+		return;
+
+	for (i = 0; i < h; i++) {
+		row = mosaic->canvas + (y + i) * mosaic->pitch + x * 2;
+		for (j = 0; j < w * 2; j += 4)
+			memcpy(row + j, black, 4);
+	}
+
+	mosaic_damage(mosaic, x, y, w, h);
+}
+
+void
+mosaic_damage(struct mosaic *mosaic, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	if (!mosaic->manual_update || !w || !h)
+		return;
+
+	g_mutex_lock(&mosaic->lock);
+	if (!mosaic->x1) {
+		mosaic->x0 = x;
+		mosaic->y0 = y;
+		mosaic->x1 = x + w;
+		mosaic->y1 = y + h;
+	} else {
+		mosaic->x0 = MIN(mosaic->x0, x);
+		mosaic->y0 = MIN(mosaic->y0, y);
+		mosaic->x1 = MAX(mosaic->x1, x + w);
+		mosaic->y1 = MAX(mosaic->y1, y + h);
+	}
+	g_cond_signal(&mosaic->cond);
+	g_mutex_unlock(&mosaic->lock);
+}
@@ -0,0 +1,43 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <stdint.h>
+
+#include "backend.h"
+
+/*
+ * Software mosaic.
+ *
+ * Sinks that join the same named group share one video overlay: a UYVY
+ * canvas the size of the display, scanned out 1:1. Each member converts its
+ * frames straight into its own rectangle of the canvas and reports the
+ * damage; on manual update panels the damage of all members is pushed with
+ * a single update per display refresh. The canvas is single buffered, so a
+ * tile may tear while it is being drawn.
+ */
+
+struct mosaic;
+
+/*
+ * Join the group, setting up the overlay when this is the first member;
+ * timeout_ms is passed on to overlay_acquire(). NULL on failure.
+ */
+struct mosaic *mosaic_join(const char *name, const struct omapfb_backend *backend,
+		int timeout_ms, unsigned width, unsigned height);
+void mosaic_leave(struct mosaic *mosaic);
+
+uint8_t *mosaic_canvas(struct mosaic *mosaic, unsigned *width, unsigned *height, unsigned *pitch);
+
+/* fill an area with black */
+void mosaic_clear(struct mosaic *mosaic, unsigned x, unsigned y, unsigned w, unsigned h);
+
+/* an area was drawn and has to reach the display */
+void mosaic_damage(struct mosaic *mosaic, unsigned x, unsigned y, unsigned w, unsigned h);
+
+#endif /* MOSAIC_H */
@@ -26,10 +26,34 @@
 #include "omapfb.h"
 #include "log.h"
 #include "image-format-conversions.h"
+#include "convert-pool.h"
+#include "backend.h"
+#include "stats.h"
+#include "overlay-alloc.h"
+#include "mosaic.h"
+#include "trace.h"
 
 #define ROUND_UP(num, scale) (((num) + ((scale) - 1)) & ~((scale) - 1))
 
+/* RGB caps have no fourcc; these tag them internally */
+#define FOURCC_RGB16 GST_MAKE_FOURCC('R', 'G', 'B', '6')
+#define FOURCC_BGRX GST_MAKE_FOURCC('B', 'G', 'R', 'x')
+#define FOURCC_BGRA GST_MAKE_FOURCC('B', 'G', 'R', 'A')
+
+/* default number of frames that fit in the overlay memory */
+#define NUM_BUFFERS 3
+#define MAX_BUFFERS 3
+
+/*
+ * Largest downscale the overlay scaler is trusted with; I420 sources that
+ * need more are box filtered by 2 or 4 while converting.
+ */
+#define MAX_PLANE_DOWNSCALE 2
+
 static GstElementClass *parent_class = NULL;
+static const struct omapfb_backend *backend;
+/* every conversion lands in overlay memory */
+static const struct conversion_impl *conversion;
 
 #ifndef GST_DISABLE_GST_DEBUG
 GstDebugCategory *omapfb_debug;
@@ -40,23 +64,25 @@ enum
 	PROP_RENDER_X = 1,
 	PROP_RENDER_Y,
 	PROP_RENDER_W,
-	PROP_RENDER_H
+	PROP_RENDER_H,
+	PROP_BUFFERS,
+	PROP_VSYNC,
+	PROP_CONVERSION_THREADS,
+	PROP_NATIVE_YUV420,
+	PROP_FRAMES_RENDERED,
+	PROP_FRAMES_DROPPED,
+	PROP_FRAMES_SKIPPED,
+	PROP_STATS,
+	PROP_STATS_INTERVAL,
+	PROP_ROTATION,
+	PROP_MIRROR,
+	PROP_RENDER_RECTANGLE,
+	PROP_OVERLAY_TIMEOUT,
+	PROP_MOSAIC_GROUP,
+	PROP_TRACE,
+	PROP_TRACE_DUMP
 };
 
-static int fb_used = 0;
-GMutex fb_used_lock;
-
-#define FB_USED_MUTEX_LOCK() G_STMT_START {                               \
-    GST_LOG ("locking fb_used from thread %p", g_thread_self ());         \
-    g_mutex_lock (&fb_used_lock);					                      \
-    GST_LOG ("locked fb_used from thread %p", g_thread_self ());          \
-} G_STMT_END
-
-#define FB_USED_MUTEX_UNLOCK() G_STMT_START {                             \
-    GST_LOG ("unlocking fb_used from thread %p", g_thread_self ());		  \
-    g_mutex_unlock (&fb_used_lock);                                       \
-} G_STMT_END
-
 
 struct gst_omapfb_sink {
 	GstBaseSink parent;
@@ -67,26 +93,149 @@ struct gst_omapfb_sink {
 	int par_n, par_d;
 	int width, height;
 	guint32 fourcc;
+	/* size of the frame in the overlay, the source divided by downscale */
+	int frame_width, frame_height;
+	int downscale;
+	/* requested orientation, and the rotation done while converting */
+	unsigned rotation;
+	bool mirror;
+	unsigned rotate;
 
 	int overlay_fd;
-	short devid;
-	const char *dev;
-	unsigned char *framebuffer;
+	int devid;
+	char dev[16];
+	int overlay_timeout;
+	struct fb_mapping *mapping;
+
+	/* in a mosaic the frames go to 'tile' of the shared canvas instead */
+	char *mosaic_group;
+	struct mosaic *mosaic;
+	GstVideoRectangle tile;
+
+	size_t framesize;
+	unsigned nbuffers;
+	unsigned req_buffers;
 	bool enabled;
 	bool manual_update;
 	GstCaps *caps;
 
-	/* target video rectangle */
+	/*
+	 * Target video rectangle, published with a seqlock: rect_seq is odd
+	 * while a writer, serialized by rect_lock, updates it. Rotation and
+	 * mirror changes bump it too; geometry_seq is the last one applied.
+	 */
+	GMutex rect_lock;
+	volatile gint rect_seq;
 	GstVideoRectangle render_rect;
 	gboolean have_render_rect;
-	gboolean render_rect_changed;
+	gint geometry_seq;
+
+	/*
+	 * framebuffer slots handed out by buffer_alloc(); fb_buffers counts
+	 * those not freed yet, of any generation. Until they are all back the
+	 * slot layout can't change (awaiting_buffers).
+	 */
+	GMutex slot_lock;
+	unsigned front;
+	unsigned slots_busy;
+	unsigned generation;
+	unsigned fb_buffers;
+	bool awaiting_buffers;
+
+	/* presentation thread; pending and retiring are protected by slot_lock */
+	bool vsync;
+	GThread *present_thread;
+	GCond present_cond;
+	bool present_running;
+	int pending;
+	int retiring;
+
+	/* serializes device reconfiguration against flips */
+	GMutex dev_lock;
+
+	/*
+	 * Each slot's picture, numbered so that a buffer shown again keeps its
+	 * number; the window and picture last pushed to a manual update panel
+	 * are protected by dev_lock.
+	 */
+	unsigned picture[MAX_BUFFERS];
+	unsigned picture_seq;
+	bool picture_mirror;
+	struct omapfb_update_window updated;
+	unsigned updated_picture;
+
+	unsigned conversion_threads;
+	struct convert_pool *convert_pool;
+
+	/* scan out I420 as is when the overlay takes a 4:2:0 layout */
+	bool yuv420;
+	bool yuv420_rejected;
+	bool native_yuv420;
+
+	/* statistics; each series is written by one thread at a time */
+	struct stats_series convert_time;
+	struct stats_series update_time;
+	struct stats_series latency;
+	uint64_t arrival[MAX_BUFFERS];
+	volatile gint frames_rendered;
+	volatile gint frames_dropped;
+	volatile gint frames_skipped;
+	unsigned stats_interval;
+	uint64_t last_stats;
+
+	/*
+	 * Basesink drops late buffers before render(); a buffer that arrived
+	 * and was not rendered by the time the next one comes never made it.
+	 */
+	bool awaiting_render;
+
+	/*
+	 * The buffer on screen, to tell when a buffer only repeats it; the
+	 * reference keeps its memory from being reused for another frame.
+	 */
+	GstBuffer *shown;
+	gint shown_geometry;
+};
+
+/* for NV12/NV21 'u' points to the interleaved chroma plane */
+struct yuv_frame {
+	guint32 fourcc;
+	int width, height;
+	int downscale;
+	unsigned rotation;
+	bool mirror;
+	int y_pitch, uv_pitch;
+	guint8 *y, *u, *v;
+	guint8 *dest;
+	int dest_pitch;
+};
+
+/* the mapped overlay memory, unmapped when neither the sink nor an fb buffer uses it */
+struct fb_mapping {
+	unsigned char *data;
+	size_t size;
+	volatile gint refs;
+};
+
+struct fb_slot_ref {
+	struct gst_omapfb_sink *self;
+	struct fb_mapping *mapping;
+	unsigned index;
+	unsigned generation;
 };
 
 struct gst_omapfb_sink_class {
 	GstBaseSinkClass parent_class;
 };
 
-static struct fb_var_screeninfo _varinfo;
+/*
+ * Display state shared by the sinks of the process. No device is touched
+ * until a sink starts; the first one to start after all have stopped probes
+ * the display again, so a changed mode is picked up between sessions.
+ */
+static GMutex display_lock;
+static unsigned display_users;
+static struct fb_var_screeninfo _varinfo = { .xres = G_MAXUINT, .yres = G_MAXUINT };
 
 #define GST_IS_OMAPFBSINK(obj) \
   (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_OMAPFB_SINK_TYPE))
@@ -126,16 +275,17 @@ generate_sink_template(void)
 		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('I', '4', '2', '0'));
 		gst_value_list_append_value(&list, &val);
 
-#if 0
-		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('Y', 'U', 'Y', '2'));
+		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('N', 'V', '1', '2'));
 		gst_value_list_append_value(&list, &val);
 
-		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('U', 'Y', 'V', 'Y'));
+		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('N', 'V', '2', '1'));
+		gst_value_list_append_value(&list, &val);
+
+		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('Y', 'U', 'Y', '2'));
 		gst_value_list_append_value(&list, &val);
-#else
+
 		gst_value_set_fourcc(&val, GST_MAKE_FOURCC('U', 'Y', 'V', 'Y'));
 		gst_value_list_append_value(&list, &val);
-#endif
 
 		gst_structure_set_value(struc, "format", &list);
 
@@ -143,160 +293,1121 @@ generate_sink_template(void)
 		g_value_unset(&list);
 	}
 
-	gst_caps_append_structure(caps, struc);
+	gst_caps_append_structure(caps, struc);
+
+	/* larger I420 is downscaled while converting when the overlay can't */
+	struc = gst_structure_new("video/x-raw-yuv",
+			"width", GST_TYPE_INT_RANGE, 16, 1920,
+			"height", GST_TYPE_INT_RANGE, 16, 1080,
+			"framerate", GST_TYPE_FRACTION_RANGE, 0, 1, 30, 1,
+			"format", GST_TYPE_FOURCC, GST_MAKE_FOURCC('I', '4', '2', '0'),
+			NULL);
+	gst_caps_append_structure(caps, struc);
+
+	/* RGB565 */
+	struc = gst_structure_new("video/x-raw-rgb",
+			"width", GST_TYPE_INT_RANGE, 16, 800,
+			"height", GST_TYPE_INT_RANGE, 16, 600,
+			"framerate", GST_TYPE_FRACTION_RANGE, 0, 1, 30, 1,
+			"bpp", G_TYPE_INT, 16,
+			"depth", G_TYPE_INT, 16,
+			"endianness", G_TYPE_INT, G_LITTLE_ENDIAN,
+			"red_mask", G_TYPE_INT, 0xf800,
+			"green_mask", G_TYPE_INT, 0x07e0,
+			"blue_mask", G_TYPE_INT, 0x001f,
+			NULL);
+	gst_caps_append_structure(caps, struc);
+
+	/* xRGB in a little endian word, BGRx in memory */
+	struc = gst_structure_new("video/x-raw-rgb",
+			"width", GST_TYPE_INT_RANGE, 16, 800,
+			"height", GST_TYPE_INT_RANGE, 16, 600,
+			"framerate", GST_TYPE_FRACTION_RANGE, 0, 1, 30, 1,
+			"bpp", G_TYPE_INT, 32,
+			"depth", G_TYPE_INT, 24,
+			"endianness", G_TYPE_INT, G_BIG_ENDIAN,
+			"red_mask", G_TYPE_INT, 0x0000ff00,
+			"green_mask", G_TYPE_INT, 0x00ff0000,
+			"blue_mask", G_TYPE_INT, 0xff000000,
+			NULL);
+	gst_caps_append_structure(caps, struc);
+
+	/* ARGB in a little endian word, BGRA in memory */
+	struc = gst_structure_new("video/x-raw-rgb",
+			"width", GST_TYPE_INT_RANGE, 16, 800,
+			"height", GST_TYPE_INT_RANGE, 16, 600,
+			"framerate", GST_TYPE_FRACTION_RANGE, 0, 1, 30, 1,
+			"bpp", G_TYPE_INT, 32,
+			"depth", G_TYPE_INT, 32,
+			"endianness", G_TYPE_INT, G_BIG_ENDIAN,
+			"red_mask", G_TYPE_INT, 0x0000ff00,
+			"green_mask", G_TYPE_INT, 0x00ff0000,
+			"blue_mask", G_TYPE_INT, 0xff000000,
+			"alpha_mask", G_TYPE_INT, 0x000000ff,
+			NULL);
+	gst_caps_append_structure(caps, struc);
+
+	return caps;
+}
+
+/* the overlay scans out packed formats as they are; planar ones are converted to UYVY */
+static int
+overlay_color_mode(guint32 fourcc)
+{
+	switch (fourcc) {
+	case GST_MAKE_FOURCC('Y', 'U', 'Y', '2'):
+		return OMAPFB_COLOR_YUY422;
+	case FOURCC_RGB16:
+		return OMAPFB_COLOR_RGB565;
+	case FOURCC_BGRX:
+		return OMAPFB_COLOR_RGB24U;
+	case FOURCC_BGRA:
+		return OMAPFB_COLOR_ARGB32;
+	default:
+		return OMAPFB_COLOR_YUV422;
+	}
+}
+
+static inline bool
+is_rgb(guint32 fourcc)
+{
+	return fourcc == FOURCC_RGB16 || fourcc == FOURCC_BGRX || fourcc == FOURCC_BGRA;
+}
+
+static inline bool
+is_packed(guint32 fourcc)
+{
+	return fourcc == GST_MAKE_FOURCC('U', 'Y', 'V', 'Y') ||
+		fourcc == GST_MAKE_FOURCC('Y', 'U', 'Y', '2') ||
+		is_rgb(fourcc);
+}
+
+/* of the frames as the overlay scans them out */
+static inline int
+bytes_per_pixel(guint32 fourcc)
+{
+	return (fourcc == FOURCC_BGRX || fourcc == FOURCC_BGRA) ? 4 : 2;
+}
+
+static inline void
+set_bitfield(struct fb_bitfield *field, int offset, int length)
+{
+	field->offset = offset;
+	field->length = length;
+	field->msb_right = 0;
+}
+
+/*
+ * omapfb only looks at nonstd for YUV modes; RGB modes are picked from the
+ * depth and the channel layout.
+ */
+static void
+set_color_mode(struct fb_var_screeninfo *info, int mode)
+{
+	switch (mode) {
+	case OMAPFB_COLOR_RGB565:
+		info->nonstd = 0;
+		info->bits_per_pixel = 16;
+		set_bitfield(&info->red, 11, 5);
+		set_bitfield(&info->green, 5, 6);
+		set_bitfield(&info->blue, 0, 5);
+		set_bitfield(&info->transp, 0, 0);
+		break;
+	case OMAPFB_COLOR_RGB24U:
+	case OMAPFB_COLOR_ARGB32:
+		info->nonstd = 0;
+		info->bits_per_pixel = 32;
+		set_bitfield(&info->red, 16, 8);
+		set_bitfield(&info->green, 8, 8);
+		set_bitfield(&info->blue, 0, 8);
+		if (mode == OMAPFB_COLOR_ARGB32)
+			set_bitfield(&info->transp, 24, 8);
+		else
+			set_bitfield(&info->transp, 0, 0);
+		break;
+	default:
+		info->nonstd = mode;
+		info->bits_per_pixel = 16;
+		break;
+	}
+}
+
+/*
+ * Push the area of the display covered by the video plane to a manual update
+ * panel; the rest of the screen has not changed, and neither has the plane
+ * when the same picture is shown in the same window again.
+ */
+static void
+update(struct gst_omapfb_sink *self, unsigned picture)
+{
+	struct omapfb_update_window update_window;
+	unsigned x, y, w, h;
+	uint64_t start, end;
+
+	if (!self->enabled || !self->plane_info.enabled)
+		return;
+
+	x = self->plane_info.pos_x;
+	y = self->plane_info.pos_y;
+	w = self->plane_info.out_width;
+	h = self->plane_info.out_height;
+
+	if (!w || !h)
+		return;
+
+	memset(&update_window, 0, sizeof(update_window));
+	update_window.x = x;
+	update_window.y = y;
+	update_window.width = w;
+	update_window.height = h;
+	update_window.format = 0;
+	update_window.out_x = x;
+	update_window.out_y = y;
+	update_window.out_width = w;
+	update_window.out_height = h;
+
+	if (picture == self->updated_picture &&
+			!memcmp(&update_window, &self->updated, sizeof(update_window))) {
+		trace_mark("unchanged", picture);
+		return;
+	}
+
+	start = stats_now();
+	if (backend->ioctl(self->overlay_fd, OMAPFB_UPDATE_WINDOW, &update_window))
+		pr_debug(self, "could not update window");
+	end = stats_now();
+	stats_series_add(&self->update_time, end - start);
+	trace_span("update", start, end, w * h);
+
+	self->updated = update_window;
+	self->updated_picture = picture;
+}
+
+static inline unsigned char *
+slot_data(struct gst_omapfb_sink *self, unsigned index)
+{
+	return self->mapping->data + index * self->framesize;
+}
+
+static void apply_geometry_locked(struct gst_omapfb_sink *self, gboolean allow_format);
+
+/* generation is the slot layout index was taken from */
+static void
+flip(struct gst_omapfb_sink *self, unsigned index, unsigned generation)
+{
+	unsigned yoffset;
+	uint64_t start;
+
+	g_mutex_lock(&self->dev_lock);
+
+	/* the slots were laid out again since; the frame went with them */
+	if (generation != self->generation) {
+		g_mutex_unlock(&self->dev_lock);
+		pr_debug(self, "dropping frame from a previous configuration");
+		g_atomic_int_inc(&self->frames_dropped);
+		return;
+	}
+	yoffset = index * self->frame_height;
+
+	/* a moved window takes effect with the frame, not in between */
+	apply_geometry_locked(self, false);
+
+	/* the plane already scans out this slot */
+	if (self->overlay_info.yoffset != yoffset) {
+		self->overlay_info.xoffset = 0;
+		self->overlay_info.yoffset = yoffset;
+
+		start = stats_now();
+		if (backend->ioctl(self->overlay_fd, FBIOPAN_DISPLAY, &self->overlay_info))
+			pr_err(self, "could not pan to buffer %u", index);
+		trace_span("pan", start, stats_now(), index);
+	}
+
+	if (self->manual_update)
+		update(self, self->picture[index]);
+
+	g_mutex_unlock(&self->dev_lock);
+
+	stats_series_add(&self->latency, stats_now() - self->arrival[index]);
+	g_atomic_int_inc(&self->frames_rendered);
+	trace_mark("shown", index);
+}
+
+static void
+wait_for_vsync(struct gst_omapfb_sink *self)
+{
+	uint64_t start = stats_now();
+	int r;
+
+	/* on manual update panels GO clears once the previous update is out */
+	if (self->manual_update)
+		r = backend->ioctl(self->overlay_fd, OMAPFB_WAITFORGO, NULL);
+	else
+		r = backend->ioctl(self->overlay_fd, OMAPFB_WAITFORVSYNC, NULL);
+
+	if (r)
+		pr_debug(self, "could not wait for vsync");
+	trace_span("vsync", start, stats_now(), r);
+}
+
+static gpointer
+present_loop(gpointer data)
+{
+	struct gst_omapfb_sink *self = data;
+	unsigned generation;
+	int index;
+
+	g_mutex_lock(&self->slot_lock);
+	while (self->present_running) {
+		if (self->pending < 0 && self->retiring < 0) {
+			g_cond_wait(&self->present_cond, &self->slot_lock);
+			continue;
+		}
+		g_mutex_unlock(&self->slot_lock);
+
+		wait_for_vsync(self);
+
+		g_mutex_lock(&self->slot_lock);
+
+		/* the previous flip has been latched by now */
+		self->retiring = -1;
+
+		index = self->pending;
+		if (index < 0)
+			continue;
+
+		self->pending = -1;
+		self->retiring = self->front;
+		self->front = index;
+		generation = self->generation;
+		g_mutex_unlock(&self->slot_lock);
+
+		flip(self, index, generation);
+
+		g_mutex_lock(&self->slot_lock);
+	}
+	g_mutex_unlock(&self->slot_lock);
+
+	return NULL;
+}
+
+/*
+ * Hand a completed frame over for display. With the presentation thread the
+ * most recent frame replaces any that has not been shown yet; otherwise the
+ * flip happens right away on the streaming thread.
+ */
+static void
+present(struct gst_omapfb_sink *self, unsigned index)
+{
+	unsigned generation;
+
+	g_mutex_lock(&self->slot_lock);
+	if (self->present_thread) {
+		/* the frame that was waiting will never be shown */
+		if (self->pending >= 0) {
+			g_atomic_int_inc(&self->frames_dropped);
+			trace_mark("replaced", self->pending);
+		}
+		self->pending = index;
+		g_cond_signal(&self->present_cond);
+		g_mutex_unlock(&self->slot_lock);
+		return;
+	}
+	self->front = index;
+	generation = self->generation;
+	g_mutex_unlock(&self->slot_lock);
+
+	flip(self, index, generation);
+}
+
+static void
+start_presentation(struct gst_omapfb_sink *self)
+{
+	self->pending = self->retiring = -1;
+
+	if (!self->vsync)
+		return;
+
+	self->present_running = true;
+	self->present_thread = g_thread_try_new("omapfb-present", present_loop, self, NULL);
+	if (!self->present_thread) {
+		self->present_running = false;
+		pr_warning(self, "could not create presentation thread");
+	}
+}
+
+static void
+stop_presentation(struct gst_omapfb_sink *self)
+{
+	if (!self->present_thread)
+		return;
+
+	g_mutex_lock(&self->slot_lock);
+	self->present_running = false;
+	g_cond_signal(&self->present_cond);
+	g_mutex_unlock(&self->slot_lock);
+
+	g_thread_join(self->present_thread);
+	self->present_thread = NULL;
+}
+
+static struct fb_mapping *
+mapping_new(int fd, size_t size)
+{
+	struct fb_mapping *mapping;
+	unsigned char *data;
+
+	data = backend->mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	mapping = g_new(struct fb_mapping, 1);
+	mapping->data = data;
+	mapping->size = size;
+	mapping->refs = 1;
+
+	return mapping;
+}
+
+static void
+mapping_unref(struct fb_mapping *mapping)
+{
+	if (!g_atomic_int_dec_and_test(&mapping->refs))
+		return;
+
+	if (backend->munmap(mapping->data, mapping->size))
+		pr_err(NULL, "could not unmap %s", strerror(errno));
+	g_free(mapping);
+}
+
+static void
+fb_slot_release(gpointer data)
+{
+	struct fb_slot_ref *ref = data;
+	struct gst_omapfb_sink *self = ref->self;
+
+	g_mutex_lock(&self->slot_lock);
+	if (ref->generation == self->generation)
+		self->slots_busy &= ~(1 << ref->index);
+	self->fb_buffers--;
+	g_mutex_unlock(&self->slot_lock);
+
+	/* after the sink stopped, the last buffer unmaps the memory */
+	mapping_unref(ref->mapping);
+	gst_object_unref(self);
+	g_free(ref);
+}
+
+/* must be called with slot_lock held */
+static int
+find_back_slot(struct gst_omapfb_sink *self)
+{
+	unsigned i;
+
+	for (i = 0; i < self->nbuffers; i++) {
+		if (i == self->front || (int) i == self->pending || (int) i == self->retiring)
+			continue;
+		if (!(self->slots_busy & (1 << i)))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Pick the slot to convert the next frame into. When every other slot is
+ * taken we rather overwrite a frame that has not been shown yet. Slots
+ * upstream holds as fb buffers are never written, and the one being
+ * scanned out only with single buffering; -1 when nothing is left.
+ */
+static int
+back_slot(struct gst_omapfb_sink *self)
+{
+	int i;
+
+	g_mutex_lock(&self->slot_lock);
+	i = find_back_slot(self);
+	if (i < 0 && self->pending >= 0 && !(self->slots_busy & (1 << self->pending))) {
+		i = self->pending;
+		self->pending = -1;
+		g_atomic_int_inc(&self->frames_dropped);
+	}
+	if (i < 0 && self->nbuffers == 1 && !(self->slots_busy & 1))
+		i = self->front;
+	g_mutex_unlock(&self->slot_lock);
+
+	return i;
+}
+
+/*
+ * Wrap a free slot of the overlay memory in a GstBuffer, so upstream writes
+ * directly into scanout memory. The slot being displayed is never handed out.
+ */
+static GstBuffer *
+fb_buffer_new(struct gst_omapfb_sink *self)
+{
+	GstBuffer *buffer;
+	struct fb_slot_ref *ref;
+	int i;
+
+	g_mutex_lock(&self->slot_lock);
+	i = find_back_slot(self);
+	if (i < 0) {
+		g_mutex_unlock(&self->slot_lock);
+		return NULL;
+	}
+	self->slots_busy |= 1 << i;
+	self->fb_buffers++;
+
+	ref = g_new(struct fb_slot_ref, 1);
+	ref->self = gst_object_ref(self);
+	ref->mapping = self->mapping;
+	g_atomic_int_inc(&self->mapping->refs);
+	ref->index = i;
+	ref->generation = self->generation;
+	g_mutex_unlock(&self->slot_lock);
+
+	buffer = gst_buffer_new();
+	GST_BUFFER_DATA(buffer) = slot_data(self, i);
+	GST_BUFFER_SIZE(buffer) = self->framesize;
+	GST_BUFFER_MALLOCDATA(buffer) = (guint8 *) ref;
+	GST_BUFFER_FREE_FUNC(buffer) = fb_slot_release;
+
+	return buffer;
+}
+
+/* clamp the rectangle to the display; false if nothing is left of it */
+static bool
+check_render_rect(GstVideoRectangle *rect)
+{
+	if ((guint) rect->x > _varinfo.xres-16)
+	  rect->x = _varinfo.xres-16;
+	if ((guint) rect->y > _varinfo.yres-16)
+	  rect->y = _varinfo.yres-16;
+	if ((guint) rect->x + (guint) rect->w > _varinfo.xres)
+	  rect->w = _varinfo.xres - (guint) rect->x;
+	if ((guint) rect->y + (guint) rect->h > _varinfo.yres)
+	  rect->h = _varinfo.yres - (guint) rect->y;
+
+	return rect->w && rect->h;
+}
+
+/* consistent snapshot of the render rectangle; returns its sequence number */
+static gint
+read_render_rect(struct gst_omapfb_sink *self, GstVideoRectangle *rect, gboolean *have)
+{
+	gint seq;
+
+	seq = g_atomic_int_get(&self->rect_seq);
+	if (!(seq & 1)) {
+		*rect = self->render_rect;
+		*have = self->have_render_rect;
+		if (g_atomic_int_get(&self->rect_seq) == seq)
+			return seq;
+	}
+
+	/* a writer is in the middle; rather than spin on it, wait for it */
+	g_mutex_lock(&self->rect_lock);
+	seq = g_atomic_int_get(&self->rect_seq);
+	*rect = self->render_rect;
+	*have = self->have_render_rect;
+	g_mutex_unlock(&self->rect_lock);
+
+	return seq;
+}
+
+/*
+ * Publish a new render rectangle; NULL only signals that the rotation or
+ * mirror setting changed. The next flip picks it up. Writers hold rect_lock.
+ */
+static void
+write_render_rect_locked(struct gst_omapfb_sink *self, const GstVideoRectangle *rect)
+{
+	if (rect && self->have_render_rect && !memcmp(rect, &self->render_rect, sizeof(*rect)))
+		return;
+	g_atomic_int_inc(&self->rect_seq);
+	if (rect) {
+		self->render_rect = *rect;
+		self->have_render_rect = true;
+	}
+	g_atomic_int_inc(&self->rect_seq);
+}
+
+static void
+write_render_rect(struct gst_omapfb_sink *self, const GstVideoRectangle *rect)
+{
+	g_mutex_lock(&self->rect_lock);
+	write_render_rect_locked(self, rect);
+	g_mutex_unlock(&self->rect_lock);
+}
+
+/*
+ * Try to program the overlay for contiguous Y, U and V planes. Drivers that
+ * don't support it either fail the ioctl or silently pick another mode; in
+ * both cases we remember it and convert to UYVY from then on.
+ */
+static bool
+probe_yuv420(struct gst_omapfb_sink *self)
+{
+	struct fb_var_screeninfo info;
+
+	self->overlay_info.nonstd = OMAPFB_COLOR_YUV420;
+	self->overlay_info.bits_per_pixel = 12;
+
+	if (backend->ioctl(self->overlay_fd, FBIOPUT_VSCREENINFO, &self->overlay_info) ||
+			backend->ioctl(self->overlay_fd, FBIOGET_VSCREENINFO, &info) ||
+			info.nonstd != OMAPFB_COLOR_YUV420) {
+		pr_info(self, "overlay does not support YUV420, converting to UYVY");
+		self->yuv420_rejected = true;
+		return false;
+	}
+
+	pr_info(self, "scanning out YUV420 %ux%u",
+			self->overlay_info.xres, self->overlay_info.yres);
+	return true;
+}
+
+/* where the plane goes on the display, and the frame size it fits in there */
+struct plane_geometry {
+	unsigned rotate;
+	int downscale;
+	unsigned rx, ry, rw, rh;
+	unsigned out_width, out_height;
+};
+
+/*
+ * Fit the frame into the render rectangle, or the whole display, and pick
+ * the conversion-side rotation and prescale that go with it.
+ */
+static void
+plan_geometry(struct gst_omapfb_sink *self, GstVideoRectangle *rect, gboolean have_rect,
+		struct plane_geometry *g)
+{
+	int width, height, par_n, par_d;
+
+	/*
+	 * The plane can only mirror; any rotation is done while converting,
+	 * which needs a planar source.
+	 */
+	g->rotate = is_packed(self->fourcc) ? 0 : self->rotation;
+
+	if (g->rotate == 90 || g->rotate == 270) {
+		width = self->height;
+		height = self->width;
+		par_n = self->par_d;
+		par_d = self->par_n;
+	} else {
+		width = self->width;
+		height = self->height;
+		par_n = self->par_n;
+		par_d = self->par_d;
+	}
+
+	if (have_rect && check_render_rect(rect)) {
+	  g->rw = rect->w & ~0xf;
+	  g->rh = rect->h & ~0xf;
+	  g->rx = rect->x + (rect->w-g->rw)/2;
+	  g->ry = rect->y + (rect->h-g->rh)/2;
+	} else  {
+	  g->rx = 0;
+	  g->ry = 0;
+	  g->rw = _varinfo.xres;
+	  g->rh = _varinfo.yres;
+	}
+	/* scale to width */
+	g->out_width = g->rw;
+	g->out_height =
+		(height * par_d * g->rw + width * par_n/2)
+		/ (width * par_n);
+	if (g->out_height > g->rh) {
+		/* scale to height */
+		g->out_height = g->rh;
+		g->out_width =
+			(width * par_n * g->rh + height * par_d/2)
+			/ (height * par_d);
+	}
+	g->out_width = ROUND_UP(g->out_width, 2);
+	g->out_height = ROUND_UP(g->out_height, 2);
+
+	/* a rotated frame is prescaled before it is turned, so compare it turned */
+	g->downscale = 1;
+	if (self->fourcc == GST_MAKE_FOURCC('I', '4', '2', '0')) {
+		while (g->downscale < 4 &&
+				((unsigned) width > g->out_width * g->downscale * MAX_PLANE_DOWNSCALE ||
+				 (unsigned) height > g->out_height * g->downscale * MAX_PLANE_DOWNSCALE))
+			g->downscale *= 2;
+	}
+}
+
+/* a held fb buffer would keep the slots from being laid out again */
+static void
+forget_shown(struct gst_omapfb_sink *self)
+{
+	if (!self->shown)
+		return;
+
+	gst_buffer_unref(self->shown);
+	self->shown = NULL;
+}
+
+/*
+ * Memory and format stage: size the frames, make sure the mapped overlay
+ * memory holds them and program the overlay format. The memory only ever
+ * grows, so caps changes to an equal or smaller size keep the mapping.
+ */
+static gboolean
+setup_format_locked(struct gst_omapfb_sink *self, const struct plane_geometry *g)
+{
+	size_t size;
+	unsigned busy;
+
+	self->awaiting_buffers = false;
+	forget_shown(self);
+
+	if (self->rotation && !g->rotate)
+		pr_info(self, "rotation needs a planar format, ignoring it");
+
+	self->plane_info.enabled = 0;
+	if (backend->ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
+		pr_err(self, "could not disable plane");
+		return false;
+	}
+	self->enabled = false;
+
+	/*
+	 * Buffers upstream still holds point into the current slots, and
+	 * omapfb refuses to resize mapped memory. Frames are dropped until
+	 * they come back; show_frame() retries then.
+	 */
+	g_mutex_lock(&self->slot_lock);
+	busy = self->fb_buffers;
+	if (busy) {
+		g_mutex_unlock(&self->slot_lock);
+		pr_debug(self, "waiting for %u buffers to be freed", busy);
+		self->awaiting_buffers = true;
+		self->geometry_seq = -1;
+		return false;
+	}
+	self->generation++;
+	self->slots_busy = 0;
+	self->front = 0;
+	self->pending = self->retiring = -1;
+	self->nbuffers = self->req_buffers;
+	g_mutex_unlock(&self->slot_lock);
+
+	self->rotate = g->rotate;
+	self->downscale = g->downscale;
+
+	if (self->rotate == 90 || self->rotate == 270) {
+		/* the kernel works on whole chroma samples */
+		self->frame_width = (self->height / self->downscale) & ~1;
+		self->frame_height = (self->width / self->downscale) & ~1;
+	} else if (self->rotate) {
+		self->frame_width = (self->width / self->downscale) & ~1;
+		self->frame_height = (self->height / self->downscale) & ~1;
+	} else if (self->downscale > 1) {
+		self->frame_width = (self->width / self->downscale) & ~1;
+		self->frame_height = self->height / self->downscale;
+	} else {
+		self->frame_width = self->width;
+		self->frame_height = self->height;
+	}
+
+	if (self->downscale > 1)
+		pr_info(self, "downscaling %dx%d to %dx%d before the overlay",
+				self->width, self->height, self->frame_width, self->frame_height);
+
+	/* enough for UYVY, so a rejected 4:2:0 probe can fall back to it */
+	self->framesize = GST_ROUND_UP_2(self->frame_width) * self->frame_height * bytes_per_pixel(self->fourcc);
+	size = self->framesize * self->nbuffers;
+
+	if (size > self->mem_info.size) {
+		if (!overlay_reserve(self->devid, size)) {
+			pr_err(self, "%zu bytes of overlay memory exceed the budget", size);
+			return false;
+		}
+
+		if (self->mapping) {
+			mapping_unref(self->mapping);
+			self->mapping = NULL;
+		}
+
+		self->mem_info.type = OMAPFB_MEMTYPE_SDRAM;
+		self->mem_info.size = size;
+
+		if (backend->ioctl(self->overlay_fd, OMAPFB_SETUP_MEM, &self->mem_info)) {
+			self->mem_info.size = 0;
+			pr_err(self, "could not setup memory info %dx%d", self->width, self->height);
+			return false;
+		}
+
+		self->mapping = mapping_new(self->overlay_fd, self->mem_info.size);
+		if (!self->mapping) {
+			self->mem_info.size = 0;
+			pr_err(self, "memory map failed");
+			return false;
+		}
+	}
+
+	/* slots are framesize apart, so the panned lines have to be as long */
+	self->overlay_info.xres = self->frame_width;
+	self->overlay_info.yres = self->frame_height;
+	self->overlay_info.xres_virtual = GST_ROUND_UP_2(self->frame_width);
+	self->overlay_info.yres_virtual = self->overlay_info.yres * self->nbuffers;
+
+	self->overlay_info.xoffset = 0;
+	self->overlay_info.yoffset = 0;
+
+	self->native_yuv420 = false;
+	if (self->fourcc == GST_MAKE_FOURCC('I', '4', '2', '0') &&
+			self->yuv420 && !self->yuv420_rejected &&
+			self->downscale == 1 && !self->rotate && !(self->width & 3))
+		self->native_yuv420 = probe_yuv420(self);
+
+	if (self->native_yuv420) {
+		self->framesize = self->width * self->height * 3 / 2;
+	} else {
+		set_color_mode(&self->overlay_info, overlay_color_mode(self->fourcc));
+
+		pr_info(self, "vscreen info: width=%u, height=%u",
+				self->overlay_info.xres, self->overlay_info.yres);
+
+		if (backend->ioctl(self->overlay_fd, FBIOPUT_VSCREENINFO, &self->overlay_info)) {
+			pr_err(self, "could not set screen info");
+			return false;
+		}
+	}
+
+/*    color_key.key_type = OMAPFB_COLOR_KEY_DISABLED;*/
+/*    if (ioctl(self->overlay_fd, OMAPFB_SET_COLOR_KEY, &color_key))*/
+/*        pr_err(self, "could not disable color key");*/
+
+	return true;
+}
+
+/* Position and scale stage: only touches the plane, the frames stay valid. */
+static gboolean
+setup_geometry_locked(struct gst_omapfb_sink *self, const struct plane_geometry *g)
+{
+	int update_mode;
+	unsigned mirror = self->mirror && !self->rotate;
+
+	/* the same picture mirrored by the plane still has to reach the panel */
+	if (self->plane_info.mirror != mirror)
+		self->updated_picture = 0;
+
+	self->plane_info.enabled = 1;
+	self->plane_info.mirror = mirror;
+	self->plane_info.pos_x = g->rx + (g->rw - g->out_width) / 2;
+	self->plane_info.pos_y = g->ry + (g->rh - g->out_height) / 2;
+	self->plane_info.out_width = g->out_width;
+	self->plane_info.out_height = g->out_height;
+
+	pr_info(self, "plane info: %dx%d, offset: %d,%d",
+			self->plane_info.out_width, self->plane_info.out_height,
+			self->plane_info.pos_x, self->plane_info.pos_y);
+	pr_info(self, "render rectangle: %ux%u, offset: %d,%d", g->rw, g->rh, g->rx, g->ry);
+
+	if (backend->ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
+		pr_err(self, "could not setup plane");
+		return false;
+	}
+
+	if (!self->enabled) {
+		self->enabled = true;
+
+		/* whatever the panel held, the plane was not part of it */
+		self->updated_picture = 0;
+
+		update_mode = OMAPFB_MANUAL_UPDATE;
+		backend->ioctl(self->overlay_fd, OMAPFB_SET_UPDATE_MODE, &update_mode);
+		self->manual_update = (update_mode == OMAPFB_MANUAL_UPDATE);
+	}
+
+	return true;
+}
+
+/*
+ * Mosaic members draw 1:1 into the shared canvas: the frame is centered in
+ * the render rectangle, I420 box filtered by 2 or 4 when that makes it fit,
+ * and cropped to it otherwise. The area drawn before is blanked.
+ */
+static gboolean
+setup_tile_locked(struct gst_omapfb_sink *self, GstVideoRectangle *rect, gboolean have_rect)
+{
+	unsigned width, height, pitch;
+	unsigned rx, ry, rw, rh;
+
+	if (is_packed(self->fourcc) && self->fourcc != GST_MAKE_FOURCC('U', 'Y', 'V', 'Y')) {
+		pr_err(self, "a mosaic only takes planar YUV and UYVY");
+		self->enabled = false;
+		return false;
+	}
+
+	if (self->rotation || self->mirror)
+		pr_info(self, "rotation and mirror are not supported in a mosaic, ignoring them");
 
-	return caps;
-}
+	mosaic_canvas(self->mosaic, &width, &height, &pitch);
 
-static void
-update(struct gst_omapfb_sink *self)
-{
-	struct omapfb_update_window update_window;
-	unsigned x, y, w, h;
+	if (have_rect && check_render_rect(rect)) {
+		rx = rect->x;
+		ry = rect->y;
+		rw = MIN((unsigned) rect->w, width - rx);
+		rh = MIN((unsigned) rect->h, height - ry);
+	} else {
+		rx = ry = 0;
+		rw = width;
+		rh = height;
+	}
 
-	x = y = 0;
-	w = _varinfo.xres;
-	h = _varinfo.yres;
-	update_window.x = x;
-	update_window.y = y;
-	update_window.width = w;
-	update_window.height = h;
-	update_window.format = 0;
-	update_window.out_x = 0;
-	update_window.out_y = 0;
-	update_window.out_width = w;
-	update_window.out_height = h;
+	self->rotate = 0;
+	self->downscale = 1;
+	if (self->fourcc == GST_MAKE_FOURCC('I', '4', '2', '0')) {
+		while (self->downscale < 4 &&
+				((unsigned) self->width > rw * self->downscale ||
+				 (unsigned) self->height > rh * self->downscale))
+			self->downscale *= 2;
+	}
+	self->frame_width = (self->width / self->downscale) & ~1;
+	self->frame_height = (self->height / self->downscale) & ~1;
 
-	ioctl(self->overlay_fd, OMAPFB_UPDATE_WINDOW, &update_window);
-}
+	if (self->enabled)
+		mosaic_clear(self->mosaic, self->tile.x, self->tile.y, self->tile.w, self->tile.h);
 
-static bool
-check_render_rect(struct gst_omapfb_sink *self)
-{
-  if (self->have_render_rect) {
-	if ((guint) self->render_rect.x > _varinfo.xres-16)
-	  self->render_rect.x = _varinfo.xres-16;
-	if ((guint) self->render_rect.y > _varinfo.yres-16)
-	  self->render_rect.y = _varinfo.yres-16;
-	if ((guint) self->render_rect.x + (guint) self->render_rect.w > _varinfo.xres)
-	  self->render_rect.w = _varinfo.xres - (guint) self->render_rect.x;
-	if ((guint) self->render_rect.y + (guint) self->render_rect.h > _varinfo.yres)
-	  self->render_rect.h = _varinfo.yres - (guint) self->render_rect.y;
-
-	if (!self->render_rect.w || !self->render_rect.h)
-		self->have_render_rect = false;
-  }
+	self->tile.w = MIN((unsigned) self->frame_width, rw) & ~1;
+	self->tile.h = MIN((unsigned) self->frame_height, rh) & ~1;
+	self->tile.x = (rx + (rw - self->tile.w) / 2) & ~1;
+	self->tile.y = ry + (rh - self->tile.h) / 2;
+	self->enabled = true;
 
-  return self->have_render_rect;
+	pr_info(self, "mosaic tile: %dx%d, offset: %d,%d, downscale: %d",
+			self->tile.w, self->tile.h, self->tile.x, self->tile.y, self->downscale);
+
+	return true;
 }
 
 static gboolean
 setup_plane(struct gst_omapfb_sink *self)
 {
-	int update_mode;
-	unsigned rx, ry, rw, rh;
-	unsigned out_width, out_height;
-/*    struct omapfb_color_key color_key;*/
-	size_t framesize;
-
-	if (self->mem_info.size && munmap(self->framebuffer, self->mem_info.size)) {
-		pr_err(self, "could not unmap %s", strerror(errno));
+	struct plane_geometry g;
+	GstVideoRectangle rect;
+	gboolean have_rect;
+	gboolean ret;
+	uint64_t start = stats_now();
+
+	g_mutex_lock(&self->dev_lock);
+	forget_shown(self);
+	self->geometry_seq = read_render_rect(self, &rect, &have_rect);
+	if (self->mosaic) {
+		ret = setup_tile_locked(self, &rect, have_rect);
+	} else {
+		plan_geometry(self, &rect, have_rect, &g);
+		ret = setup_format_locked(self, &g) && setup_geometry_locked(self, &g);
+		/* not a failure, the frames just have to wait */
+		if (self->awaiting_buffers)
+			ret = true;
 	}
+	g_mutex_unlock(&self->dev_lock);
+	trace_span("setup-plane", start, stats_now(), ret);
 
-	self->plane_info.enabled = 0;
-	if (ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
-		pr_err(self, "could not disable plane");
-		return false;
-	}
+	return ret;
+}
 
-	framesize = GST_ROUND_UP_2(self->width) * self->height * 2;
+/*
+ * Apply the latest render rectangle, rotation and mirror settings. Unless
+ * the frame size has to change, only the plane is moved, so this is cheap
+ * enough to do right before a flip and lands in the same frame. A frame
+ * size change invalidates the frames in flight and is left to the
+ * streaming thread (allow_format).
+ */
+static void
+apply_geometry_locked(struct gst_omapfb_sink *self, gboolean allow_format)
+{
+	struct plane_geometry g;
+	GstVideoRectangle rect;
+	gboolean have_rect;
+	gint seq;
 
-	self->mem_info.type = OMAPFB_MEMTYPE_SDRAM;
-	self->mem_info.size = framesize;
+	if (g_atomic_int_get(&self->rect_seq) == self->geometry_seq)
+		return;
 
-	if (ioctl(self->overlay_fd, OMAPFB_SETUP_MEM, &self->mem_info)) {
-		self->mem_info.size = 0;
-		pr_err(self, "could not setup memory info %dx%d", self->width, self->height);
-		return false;
-	}
+	seq = read_render_rect(self, &rect, &have_rect);
+	trace_mark("geometry", seq);
 
-	self->framebuffer = mmap(NULL, self->mem_info.size, PROT_WRITE, MAP_SHARED, self->overlay_fd, 0);
-	if (self->framebuffer == MAP_FAILED) {
-		self->mem_info.size = 0;
-		pr_err(self, "memory map failed");
-		return false;
+	if (self->mosaic) {
+		if (setup_tile_locked(self, &rect, have_rect))
+			self->geometry_seq = seq;
+		return;
 	}
 
-	self->overlay_info.xres = self->width;
-	self->overlay_info.yres = self->height;
-	self->overlay_info.xres_virtual = self->overlay_info.xres;
-	self->overlay_info.yres_virtual = self->overlay_info.yres;
+	plan_geometry(self, &rect, have_rect, &g);
 
-	self->overlay_info.xoffset = 0;
-	self->overlay_info.yoffset = 0;
-	self->overlay_info.nonstd = OMAPFB_COLOR_YUV422;
+	if (!self->enabled || g.rotate != self->rotate || g.downscale != self->downscale ||
+			self->nbuffers != self->req_buffers) {
+		if (!allow_format)
+			return;
+		if (!setup_format_locked(self, &g))
+			return;
+	}
 
-	pr_info(self, "vscreen info: width=%u, height=%u",
-			self->overlay_info.xres, self->overlay_info.yres);
+	if (setup_geometry_locked(self, &g))
+		self->geometry_seq = seq;
+}
 
-	if (ioctl(self->overlay_fd, FBIOPUT_VSCREENINFO, &self->overlay_info)) {
-		pr_err(self, "could not set screen info");
-		return false;
+static void
+convert_rows(void *data, int first_row, int rows)
+{
+	struct yuv_frame *f = data;
+	guint8 *y = f->y + first_row * f->y_pitch;
+	guint8 *dest = f->dest + first_row * f->dest_pitch;
+
+	if (f->rotation || f->mirror) {
+		/* rows are destination rows, the kernel walks the source itself */
+		guint8 *u = f->u, *v = f->v;
+		int uv_step = 1;
+
+		if (f->fourcc == GST_MAKE_FOURCC('N', 'V', '1', '2')) {
+			v = f->u + 1;
+			uv_step = 2;
+		} else if (f->fourcc == GST_MAKE_FOURCC('N', 'V', '2', '1')) {
+			u = f->u + 1;
+			uv_step = 2;
+		}
+
+		yuv420_to_uyvy_rotate(f->rotation, f->mirror, f->downscale, f->width, f->height,
+				first_row, rows, f->y_pitch, f->uv_pitch, uv_step,
+				f->y, u, v, f->dest);
+		return;
 	}
 
-/*    color_key.key_type = OMAPFB_COLOR_KEY_DISABLED;*/
-/*    if (ioctl(self->overlay_fd, OMAPFB_SET_COLOR_KEY, &color_key))*/
-/*        pr_err(self, "could not disable color key");*/
+	if (f->downscale > 1) {
+		/* rows are destination rows here */
+		int chroma_row = first_row * f->downscale / 2;
 
-	if (self->have_render_rect && check_render_rect(self)) {
-	  rw = self->render_rect.w & ~0xf;
-	  rh = self->render_rect.h & ~0xf;
-	  rx = self->render_rect.x + (self->render_rect.w-rw)/2;
-	  ry = self->render_rect.y + (self->render_rect.h-rh)/2;
-	} else  {
-	  rx = 0;
-	  ry = 0;
-	  rw = _varinfo.xres;
-	  rh = _varinfo.yres;
+		conversion->uv12_to_uyvy_box(f->downscale, f->width, rows, f->y_pitch, f->uv_pitch, f->dest_pitch,
+				f->y + first_row * f->downscale * f->y_pitch,
+				f->u + chroma_row * f->uv_pitch,
+				f->v + chroma_row * f->uv_pitch,
+				dest);
+		return;
 	}
-	/* scale to width */
-	out_width = rw;
-	out_height =
-		(self->height * self->par_d * rw + self->width * self->par_n/2)
-		/ (self->width * self->par_n);
-	if (out_height > rh) {
-		/* scale to height */
-		out_height = rh;
-		out_width =
-			(self->width * self->par_n * rh + self->height * self->par_d/2)
-			/ (self->height * self->par_d);
+
+	switch (f->fourcc) {
+	case GST_MAKE_FOURCC('N', 'V', '1', '2'):
+		conversion->nv12_to_uyvy(f->width, rows, f->y_pitch, f->uv_pitch, f->dest_pitch, y,
+				f->u + first_row / 2 * f->uv_pitch, dest);
+		break;
+	case GST_MAKE_FOURCC('N', 'V', '2', '1'):
+		conversion->nv21_to_uyvy(f->width, rows, f->y_pitch, f->uv_pitch, f->dest_pitch, y,
+				f->u + first_row / 2 * f->uv_pitch, dest);
+		break;
+	default:
+		conversion->uv12_to_uyvy(f->width, rows, f->y_pitch, f->uv_pitch, f->dest_pitch, y,
+				f->u + first_row / 2 * f->uv_pitch,
+				f->v + first_row / 2 * f->uv_pitch,
+				dest);
+		break;
 	}
-	out_width = ROUND_UP(out_width, 2);
-	out_height = ROUND_UP(out_height, 2);
+}
 
-	self->plane_info.enabled = 1;
-	self->plane_info.pos_x = rx + (rw - out_width) / 2;
-	self->plane_info.pos_y = ry + (rh - out_height) / 2;
-	self->plane_info.out_width = out_width;
-	self->plane_info.out_height = out_height;
+/* one span per stripe, so the worker threads show up in the trace */
+static void
+convert_stripe(void *data, int first_row, int rows)
+{
+	uint64_t start;
 
-	printf("plane info: %dx%d, offset: %d,%d\n",
-			self->plane_info.out_width, self->plane_info.out_height,
-			self->plane_info.pos_x, self->plane_info.pos_y);
-	printf("render rectangle: %ux%u, offset: %d,%d\n", rw, rh, rx, ry);
+	if (!trace_enabled()) {
+		convert_rows(data, first_row, rows);
+		return;
+	}
 
-	if (ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
-		pr_err(self, "could not setup plane");
-		return false;
+	start = stats_now();
+	convert_rows(data, first_row, rows);
+	trace_span("convert", start, stats_now(), first_row);
+}
+
+/* the planes of a planar source frame, as GStreamer lays them out */
+static void
+map_yuv_frame(struct gst_omapfb_sink *self, guint8 *data, struct yuv_frame *f)
+{
+	f->fourcc = self->fourcc;
+	f->y_pitch = (self->width + 3) & ~3;
+	f->y = data;
+	if (self->fourcc == GST_MAKE_FOURCC('I', '4', '2', '0')) {
+		f->uv_pitch = (((f->y_pitch >> 1) + 3) & ~3);
+		f->u = f->y + (f->y_pitch * self->height);
+		f->v = f->u + (f->uv_pitch * (self->height / 2));
+	} else {
+		/* NV12/NV21: chroma rows are as wide as luma rows */
+		f->uv_pitch = f->y_pitch;
+		f->u = f->y + (f->y_pitch * GST_ROUND_UP_2(self->height));
+		f->v = NULL;
 	}
+}
 
-	self->enabled = true;
+/*
+ * The overlay takes tightly packed planes, GStreamer rounds the strides up
+ * to 4; the width is a multiple of 4 in this mode so rows copy as 16-bit
+ * pixel pairs.
+ */
+static void
+copy_i420_planes(struct gst_omapfb_sink *self, guint8 *src, guint8 *dest)
+{
+	int w = self->width, h = self->height;
+	int y_pitch = GST_ROUND_UP_4(w);
+	int uv_pitch = GST_ROUND_UP_4(y_pitch / 2);
+	guint8 *u = src + y_pitch * h;
+	guint8 *v = u + uv_pitch * (h / 2);
+
+	conversion->packed_line_copy(w / 2, h, y_pitch, w, src, dest);
+	dest += w * h;
+	conversion->packed_line_copy(w / 4, h / 2, uv_pitch, w / 2, u, dest);
+	dest += w / 2 * (h / 2);
+	conversion->packed_line_copy(w / 4, h / 2, uv_pitch, w / 2, v, dest);
+}
 
-	update_mode = OMAPFB_MANUAL_UPDATE;
-	ioctl(self->overlay_fd, OMAPFB_SET_UPDATE_MODE, &update_mode);
-	self->manual_update = (update_mode == OMAPFB_MANUAL_UPDATE);
+/* convert straight into the tile of the mosaic canvas; frames larger than it are cropped to the middle */
+static void
+draw_tile(struct gst_omapfb_sink *self, GstBuffer *buffer)
+{
+	unsigned width, height, pitch;
+	guint8 *canvas = mosaic_canvas(self->mosaic, &width, &height, &pitch);
+	guint8 *dest = canvas + self->tile.y * pitch + self->tile.x * 2;
+	int ds = self->downscale;
+	int cx = ((self->frame_width - self->tile.w) / 2) & ~1;
+	int cy = ((self->frame_height - self->tile.h) / 2) & ~1;
+
+	if (is_packed(self->fourcc)) {
+		unsigned stride = GST_ROUND_UP_4(self->width * 2);
+		unsigned avail = GST_BUFFER_SIZE(buffer) / stride;
+		unsigned rows = avail > (unsigned) cy ? MIN((unsigned) self->tile.h, avail - cy) : 0;
+
+		conversion->packed_line_copy(self->tile.w, rows, stride, pitch,
+				GST_BUFFER_DATA(buffer) + cy * stride + cx * 2, dest);
+	} else {
+		struct yuv_frame f;
+
+		map_yuv_frame(self, GST_BUFFER_DATA(buffer), &f);
+		f.y += cy * ds * f.y_pitch + cx * ds;
+		if (self->fourcc == GST_MAKE_FOURCC('I', '4', '2', '0')) {
+			f.u += cy * ds / 2 * f.uv_pitch + cx * ds / 2;
+			f.v += cy * ds / 2 * f.uv_pitch + cx * ds / 2;
+		} else {
+			f.u += cy / 2 * f.uv_pitch + cx;
+		}
+		f.width = self->tile.w;
+		f.height = self->tile.h;
+		f.downscale = ds;
+		f.rotation = 0;
+		f.mirror = false;
+		f.dest = dest;
+		f.dest_pitch = pitch;
+
+		convert_pool_run(self->convert_pool, self->tile.h, ds > 1 ? 1 : 2,
+				convert_stripe, &f);
+	}
 
-	return true;
+	mosaic_damage(self->mosaic, self->tile.x, self->tile.y, self->tile.w, self->tile.h);
 }
 
 static gboolean
@@ -309,7 +1420,6 @@ setup(struct gst_omapfb_sink *self, GstCaps *caps)
 
 	self->caps = gst_caps_copy(caps);
 
-	_varinfo = _varinfo;
 	structure = gst_caps_get_structure(caps, 0);
 
 	gst_structure_get_int(structure, "width", &self->width);
@@ -317,7 +1427,21 @@ setup(struct gst_omapfb_sink *self, GstCaps *caps)
 	if (!gst_structure_get_fraction(structure, "pixel-aspect-ratio", &self->par_n, &self->par_d))
 		self->par_n = self->par_d = 1;
 
-	gst_structure_get_fourcc(structure, "format", &self->fourcc);
+	if (gst_structure_has_name(structure, "video/x-raw-rgb")) {
+		int bpp = 0, alpha_mask = 0;
+
+		gst_structure_get_int(structure, "bpp", &bpp);
+		gst_structure_get_int(structure, "alpha_mask", &alpha_mask);
+
+		if (bpp == 16)
+			self->fourcc = FOURCC_RGB16;
+		else if (alpha_mask)
+			self->fourcc = FOURCC_BGRA;
+		else
+			self->fourcc = FOURCC_BGRX;
+	} else {
+		gst_structure_get_fourcc(structure, "format", &self->fourcc);
+	}
 
 	return setup_plane(self);
 }
@@ -331,13 +1455,16 @@ buffer_alloc(GstBaseSink *base, guint64 offset, guint size, GstCaps *caps, GstBu
 	if (!gst_caps_is_equal(self->caps, caps) && !setup(self, caps))
 		goto missing;
 
-	buffer = gst_buffer_new_and_alloc(size);
+	buffer = NULL;
+	if (!self->mosaic && self->enabled && (is_packed(self->fourcc) || self->native_yuv420) &&
+			size == self->framesize)
+		buffer = fb_buffer_new(self);
+	if (!buffer)
+		buffer = gst_buffer_new_and_alloc(size);
 	gst_buffer_set_caps(buffer, caps);
 
 	*buf = buffer;
 
-/*    ioctl(self->overlay_fd, OMAPFB_WAITFORVSYNC);*/
-
 	return GST_FLOW_OK;
 missing:
 	*buf = NULL;
@@ -365,83 +1492,131 @@ stop(GstBaseSink *base)
 	return true;
 }
 
-static gboolean
-hide_framebuffer(struct gst_omapfb_sink *self, const char* fb)
+static bool
+init_varinfo(void)
 {
-	bool do_open = self->overlay_fd == 0;
-	if (do_open) {
-		self->overlay_fd = open(fb, O_RDWR);
+	int fd;
+	fd = backend->open("/dev/fb0", O_RDWR);
 
-		if (self->overlay_fd == -1) {
-			pr_err(self, "could not open overlay %s", fb);
-			return false;
-		}
+	_varinfo.xres = G_MAXUINT;
+	_varinfo.yres = G_MAXUINT;
+	if (fd == -1) {
+		pr_err(NULL, "could not open framebuffer");
+		return false;
 	}
 
-	if (ioctl(self->overlay_fd, OMAPFB_QUERY_PLANE, &self->plane_info)) {
-		pr_err(self, "could not query plane info for %s", fb);
+	if (backend->ioctl(fd, FBIOGET_VSCREENINFO, &_varinfo)) {
+		pr_err(NULL, "could not get screen info");
+		backend->close(fd);
 		return false;
 	}
 
-	self->plane_info.enabled = 0;
-	if (ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
-		pr_err(self, "could not disable plane %s", fb);
+	if (backend->close(fd)) {
+		pr_err(NULL, "could not close framebuffer");
 		return false;
 	}
 
-	if (do_open) {
-		close(self->overlay_fd);
-		self->overlay_fd = 0;
+	return true;
+}
+
+static void
+display_acquire(void)
+{
+	g_mutex_lock(&display_lock);
+	if (!display_users++) {
+		init_varinfo();
+		overlay_hide_idle(backend);
 	}
+	g_mutex_unlock(&display_lock);
+}
 
-	return true;
+static void
+display_release(void)
+{
+	g_mutex_lock(&display_lock);
+	display_users--;
+	g_mutex_unlock(&display_lock);
 }
 
 static gboolean
-start_video(struct gst_omapfb_sink *self)
+open_overlay(struct gst_omapfb_sink *self)
 {
-	self->dev = NULL;
-
 	self->mem_info.size = 0;
 
-	FB_USED_MUTEX_LOCK();
-	if ((fb_used & 1) == 0) {
-		self->dev = "/dev/fb1";
-		self->devid = 1;
-	} else {
-		self->dev = "/dev/fb2";
-		self->devid = 2;
-	}
-	if (fb_used >=3)
-		fb_used++;
-	else
-		fb_used |= self->devid;
-	FB_USED_MUTEX_UNLOCK();
-
-	if (fb_used > 3) {
-		pr_err(self, "more than two video framebuffer are used");
-		/* We hope this will be only for a short time and proceed. */
+	self->devid = overlay_acquire(backend, self->overlay_timeout);
+	if (self->devid < 0) {
+		pr_err(self, "no free video overlay");
+		return false;
 	}
+	snprintf(self->dev, sizeof(self->dev), "/dev/fb%d", self->devid);
 
-	printf("%s We open %s.\n", __PRETTY_FUNCTION__, self->dev);
-	self->overlay_fd = open(self->dev, O_RDWR);
+	pr_info(self, "opening %s", self->dev);
+	self->overlay_fd = backend->open(self->dev, O_RDWR);
 
 	if (self->overlay_fd == -1) {
 		pr_err(self, "could not open overlay");
-		return false;
+		goto fail;
 	}
 
-	if (ioctl(self->overlay_fd, FBIOGET_VSCREENINFO, &self->overlay_info)) {
+	if (backend->ioctl(self->overlay_fd, FBIOGET_VSCREENINFO, &self->overlay_info)) {
 		pr_err(self, "could not get overlay screen info");
-		return false;
+		goto fail_close;
 	}
 
-	if (ioctl(self->overlay_fd, OMAPFB_QUERY_PLANE, &self->plane_info)) {
+	if (backend->ioctl(self->overlay_fd, OMAPFB_QUERY_PLANE, &self->plane_info)) {
 		pr_err(self, "could not query plane info");
-		return false;
+		goto fail_close;
+	}
+
+	return true;
+
+fail_close:
+	backend->close(self->overlay_fd);
+fail:
+	overlay_release(self->devid);
+	self->devid = -1;
+	return false;
+}
+
+static gboolean
+start_video(struct gst_omapfb_sink *self)
+{
+	display_acquire();
+
+	if (self->mosaic_group && *self->mosaic_group) {
+		if (_varinfo.xres == G_MAXUINT) {
+			pr_err(self, "no display to size mosaic %s to", self->mosaic_group);
+			goto fail;
+		}
+		self->mosaic = mosaic_join(self->mosaic_group, backend, self->overlay_timeout,
+				_varinfo.xres, _varinfo.yres);
+		if (!self->mosaic)
+			goto fail;
+	} else if (!open_overlay(self)) {
+		goto fail;
 	}
 
+	stats_series_reset(&self->convert_time);
+	stats_series_reset(&self->update_time);
+	stats_series_reset(&self->latency);
+	g_atomic_int_set(&self->frames_rendered, 0);
+	g_atomic_int_set(&self->frames_dropped, 0);
+	g_atomic_int_set(&self->frames_skipped, 0);
+	self->awaiting_render = false;
+	self->last_stats = stats_now();
+
+	self->convert_pool = convert_pool_new(self->conversion_threads);
+	pr_info(self, "converting with %u threads", convert_pool_threads(self->convert_pool));
+
+	/* the mosaic pushes the updates of all its members itself */
+	if (!self->mosaic)
+		start_presentation(self);
+
 	return true;
+
+fail:
+	display_release();
+	return false;
 }
 
 static gboolean
@@ -452,33 +1627,51 @@ stop_video(struct gst_omapfb_sink* self)
 
 	self->caps = NULL;
 
+	stop_presentation(self);
+
+	convert_pool_free(self->convert_pool);
+	self->convert_pool = NULL;
+
+	forget_shown(self);
+
+	if (trace_enabled())
+		trace_dump(NULL);
+
+	if (self->mosaic) {
+		if (self->enabled)
+			mosaic_clear(self->mosaic, self->tile.x, self->tile.y, self->tile.w, self->tile.h);
+		self->enabled = false;
+		mosaic_leave(self->mosaic);
+		self->mosaic = NULL;
+		display_release();
+		return true;
+	}
+
 	if (self->enabled) {
 		self->enabled = false;
 		self->plane_info.enabled = 0;
 
-		if (ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info)) {
+		/* the overlay is released all the same */
+		if (backend->ioctl(self->overlay_fd, OMAPFB_SETUP_PLANE, &self->plane_info))
 			pr_err(self, "could not disable plane");
-			return false;
-		}
 	}
 
-	if (munmap(self->framebuffer, self->mem_info.size)) {
-		pr_err(self, "could not unmap %s", strerror(errno));
+	/* buffers upstream still holds keep the memory mapped */
+	if (self->mapping) {
+		mapping_unref(self->mapping);
+		self->mapping = NULL;
 	}
 
-	if (close(self->overlay_fd)) {
+	self->mem_info.size = 0;
+
+	if (backend->close(self->overlay_fd))
 		pr_err(self, "could not close overlay");
-		return false;
-	}
 
-	FB_USED_MUTEX_LOCK();
-	if (fb_used>3)
-		fb_used--;
-	else
-		fb_used -= self->devid;
+	pr_info(self, "closed %s", self->dev);
+	overlay_release(self->devid);
+	self->devid = -1;
+	display_release();
 
-	printf("%s We close %s. fb_used=%d\n", __PRETTY_FUNCTION__, self->dev, fb_used);
-	FB_USED_MUTEX_UNLOCK();
 	return true;
 }
 
@@ -488,11 +1681,14 @@ change_state (GstElement * element, GstStateChange transition)
   GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
   struct gst_omapfb_sink *self = (struct gst_omapfb_sink *)element;
 
+  trace_mark(gst_element_state_get_name(GST_STATE_TRANSITION_NEXT(transition)), transition);
+
   switch (transition) {
     case GST_STATE_CHANGE_NULL_TO_READY:
       break;
     case GST_STATE_CHANGE_READY_TO_PAUSED:
-	  start_video(self);
+	  if (!start_video(self))
+		return GST_STATE_CHANGE_FAILURE;
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
@@ -518,63 +1714,250 @@ change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
+static void
+add_summary(GstStructure *structure, const char *prefix, struct stats_series *series)
+{
+	struct stats_summary summary;
+	char name[32];
+
+	stats_series_summarize(series, &summary);
+
+	snprintf(name, sizeof(name), "%s-min", prefix);
+	gst_structure_set(structure, name, G_TYPE_UINT64, summary.min, NULL);
+	snprintf(name, sizeof(name), "%s-avg", prefix);
+	gst_structure_set(structure, name, G_TYPE_UINT64, summary.avg, NULL);
+	snprintf(name, sizeof(name), "%s-max", prefix);
+	gst_structure_set(structure, name, G_TYPE_UINT64, summary.max, NULL);
+	snprintf(name, sizeof(name), "%s-p99", prefix);
+	gst_structure_set(structure, name, G_TYPE_UINT64, summary.p99, NULL);
+}
+
+/* times are in nanoseconds, over the last STATS_WINDOW frames */
+static GstStructure *
+stats_structure(struct gst_omapfb_sink *self, const char *name)
+{
+	GstStructure *structure;
+
+	structure = gst_structure_new(name,
+			"frames-rendered", G_TYPE_UINT, g_atomic_int_get(&self->frames_rendered),
+			"frames-dropped", G_TYPE_UINT, g_atomic_int_get(&self->frames_dropped),
+			"frames-skipped", G_TYPE_UINT, g_atomic_int_get(&self->frames_skipped),
+			NULL);
+
+	add_summary(structure, "convert", &self->convert_time);
+	add_summary(structure, "update", &self->update_time);
+	add_summary(structure, "latency", &self->latency);
+
+	return structure;
+}
+
+/* every stats-interval ms, as an element message */
+static void
+post_stats(struct gst_omapfb_sink *self, uint64_t now)
+{
+	if (!self->stats_interval ||
+			now - self->last_stats < self->stats_interval * (uint64_t) 1000000)
+		return;
+
+	self->last_stats = now;
+	gst_element_post_message(GST_ELEMENT(self),
+			gst_message_new_element(GST_OBJECT(self),
+				stats_structure(self, "omapfb-stats")));
+}
+
+/* the buffer a subbuffer shares its memory with */
+static GstBuffer *
+root_buffer(GstBuffer *buffer)
+{
+	while (buffer->parent)
+		buffer = buffer->parent;
+
+	return buffer;
+}
+
+/*
+ * Whether the buffer shows what is already on screen: the preroll buffer
+ * rendered again, or a duplicate from videorate, which is a subbuffer of
+ * the original. As the shown buffer is referenced, nothing else can have
+ * been written into its memory. Gaps hold no picture and keep the last one.
+ */
+static bool
+same_picture(struct gst_omapfb_sink *self, GstBuffer *buffer)
+{
+	return self->shown &&
+		root_buffer(buffer) == root_buffer(self->shown) &&
+		GST_BUFFER_DATA(buffer) == GST_BUFFER_DATA(self->shown) &&
+		GST_BUFFER_SIZE(buffer) == GST_BUFFER_SIZE(self->shown);
+}
+
+static bool
+is_repeat(struct gst_omapfb_sink *self, GstBuffer *buffer)
+{
+	if (!self->shown || self->shown_geometry != self->geometry_seq)
+		return false;
+
+	if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_GAP))
+		return true;
+
+	return same_picture(self, buffer);
+}
+
+static void
+set_shown(struct gst_omapfb_sink *self, GstBuffer *buffer)
+{
+	gst_buffer_ref(buffer);
+	forget_shown(self);
+	self->shown = buffer;
+	self->shown_geometry = self->geometry_seq;
+}
+
 static GstFlowReturn
-render(GstBaseSink *base, GstBuffer *buffer)
+show_frame(GstBaseSink *base, GstBuffer *buffer)
 {
 	struct gst_omapfb_sink *self = (struct gst_omapfb_sink *)base;
+	unsigned index;
+	int slot;
+	unsigned char *dest;
+	uint64_t arrival = stats_now();
+
+	if (g_atomic_int_get(&self->rect_seq) != self->geometry_seq) {
+		g_mutex_lock(&self->dev_lock);
+		apply_geometry_locked(self, true);
+		g_mutex_unlock(&self->dev_lock);
+	}
 
-	if (self->fourcc==GST_MAKE_FOURCC('I', '4', '2', '0')) {
-		int src_y_pitch = (self->width + 3) & ~3;
-		int src_uv_pitch = (((src_y_pitch >> 1) + 3) & ~3);
-		guint8 *yb = GST_BUFFER_DATA(buffer);
-		guint8 *ub = yb + (src_y_pitch * self->height);
-		guint8 *vb = ub + (src_uv_pitch * (self->height / 2));
-		uv12_to_uyvy(self->width & ~15,
-				self->height & ~15,
-				src_y_pitch,
-				src_uv_pitch,
-				yb, ub, vb,
-				(guint8*) self->framebuffer);
-	} else {
-		memcpy(self->framebuffer, GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer));
+	/* a failed reconfiguration leaves no memory to convert into */
+	if (!self->enabled) {
+		g_atomic_int_inc(&self->frames_dropped);
+		return GST_FLOW_OK;
 	}
 
-	if (self->render_rect_changed) {
-		self->render_rect_changed = false;
-		setup_plane(self);
+	/* nothing to convert or flip, the picture stays up */
+	if (is_repeat(self, buffer)) {
+		g_atomic_int_inc(&self->frames_skipped);
+		trace_mark("skipped", GST_TIME_AS_MSECONDS(GST_BUFFER_TIMESTAMP(buffer)));
+		return GST_FLOW_OK;
 	}
 
-	if (self->manual_update)
-		update(self);
+	if (self->mosaic) {
+		uint64_t end;
+
+		draw_tile(self, buffer);
+		end = stats_now();
+		stats_series_add(&self->convert_time, end - arrival);
+		g_atomic_int_inc(&self->frames_rendered);
+		trace_span("frame", arrival, end, -1);
+		set_shown(self, buffer);
+		post_stats(self, arrival);
+		return GST_FLOW_OK;
+	}
+
+	if (GST_BUFFER_FREE_FUNC(buffer) == fb_slot_release) {
+		struct fb_slot_ref *ref = (struct fb_slot_ref *) GST_BUFFER_MALLOCDATA(buffer);
+
+		if (ref->generation != self->generation) {
+			pr_debug(self, "dropping buffer from a previous configuration");
+			g_atomic_int_inc(&self->frames_dropped);
+			return GST_FLOW_OK;
+		}
+
+		/* upstream rendered straight into the overlay; just flip */
+		index = ref->index;
+	} else {
+		/* never convert into the buffer being scanned out */
+		slot = back_slot(self);
+		if (slot < 0) {
+			pr_debug(self, "no free slot, dropping frame");
+			g_atomic_int_inc(&self->frames_dropped);
+			return GST_FLOW_OK;
+		}
+		index = slot;
+		dest = slot_data(self, index);
+
+		if (self->native_yuv420) {
+			copy_i420_planes(self, GST_BUFFER_DATA(buffer), dest);
+		} else if (!is_packed(self->fourcc)) {
+			struct yuv_frame f;
+
+			map_yuv_frame(self, GST_BUFFER_DATA(buffer), &f);
+			f.width = self->width & ~15;
+			f.height = self->height;
+			f.downscale = self->downscale;
+			f.rotation = self->rotate;
+			f.mirror = self->rotate && self->mirror;
+			f.dest = (guint8*) dest;
+			f.dest_pitch = GST_ROUND_UP_2(self->frame_width) * 2;
+
+			if (self->rotate) {
+				/* the kernel's size is the prescaled source, before turning */
+				f.width = (self->width / self->downscale) & ~1;
+				f.height = (self->height / self->downscale) & ~1;
+				convert_pool_run(self->convert_pool, self->frame_height, 2,
+						convert_stripe, &f);
+			} else if (self->downscale > 1) {
+				f.width = self->frame_width;
+				convert_pool_run(self->convert_pool, self->frame_height, 1,
+						convert_stripe, &f);
+			} else {
+				convert_pool_run(self->convert_pool, self->height & ~15, 2,
+						convert_stripe, &f);
+			}
+		} else {
+			/*
+			 * Packed rows are copied as pairs of bytes. GStreamer pads
+			 * rows to 4 bytes, the overlay lines to an even width.
+			 */
+			unsigned len = self->width * bytes_per_pixel(self->fourcc);
+			unsigned src_stride = GST_ROUND_UP_4(len);
+			unsigned dst_stride = self->framesize / self->frame_height;
+			unsigned rows = MIN((unsigned) self->frame_height, GST_BUFFER_SIZE(buffer) / src_stride);
+
+			conversion->packed_line_copy(len / 2, rows, src_stride, dst_stride,
+					GST_BUFFER_DATA(buffer), dest);
+		}
+
+		stats_series_add(&self->convert_time, stats_now() - arrival);
+	}
+
+	/* reconverted for a new window, it is still the same picture */
+	if (!same_picture(self, buffer) || self->mirror != self->picture_mirror)
+		self->picture_seq++;
+	self->picture_mirror = self->mirror;
+	self->picture[index] = self->picture_seq;
+
+	self->arrival[index] = arrival;
+	present(self, index);
+	trace_span("frame", arrival, stats_now(), index);
+	set_shown(self, buffer);
+
+	post_stats(self, arrival);
 
 	return GST_FLOW_OK;
 }
 
-static bool
-init_varinfo()
+/* streaming thread, before basesink decides whether the buffer is too late */
+static gboolean
+buffer_arrived(GstPad *pad, GstBuffer *buffer, gpointer data)
 {
-	int fd;
-	fd = open("/dev/fb0", O_RDWR);
+	struct gst_omapfb_sink *self = data;
 
-	_varinfo.xres = G_MAXUINT;
-	_varinfo.yres = G_MAXUINT;
-	if (fd == -1) {
-		fprintf(stderr, "omapfbsink: could not open framebuffer\n");
-		return false;
+	if (self->awaiting_render) {
+		g_atomic_int_inc(&self->frames_dropped);
+		trace_mark("late", -1);
 	}
+	self->awaiting_render = true;
 
-	if (ioctl(fd, FBIOGET_VSCREENINFO, &_varinfo)) {
-		fprintf(stderr, "omapfbsink: could not get screen info\n");
-		close(fd);
-		return false;
-	}
+	return TRUE;
+}
 
-	if (close(fd)) {
-		fprintf(stderr, "omapfbsink: could not close framebuffer\n");
-		return false;
-	}
+static GstFlowReturn
+render(GstBaseSink *base, GstBuffer *buffer)
+{
+	struct gst_omapfb_sink *self = (struct gst_omapfb_sink *)base;
 
-	return true;
+	self->awaiting_render = false;
+
+	return show_frame(base, buffer);
 }
 
 static void
@@ -593,7 +1976,7 @@ class_init(void *g_class, void *class_data)
     base_sink_class->start = start;
     base_sink_class->stop = stop;
 	base_sink_class->render = render;
-	base_sink_class->preroll = render;
+	base_sink_class->preroll = show_frame;
 
 	gstelement_class = (GstElementClass *) g_class;
 	gstelement_class->change_state =
@@ -603,28 +1986,115 @@ class_init(void *g_class, void *class_data)
 	gobject_class->set_property = gst_omapfb_sink_set_property;
 	gobject_class->get_property = gst_omapfb_sink_get_property;
 
-	init_varinfo();
+	backend = omapfb_backend_get();
+	conversion = conversion_impl_get_fb();
 
 	g_object_class_install_property (gobject_class, PROP_RENDER_X,
 			g_param_spec_uint ("render-x", "Render X-pos.",
-				"The X-Position of the render rectangle.",
-				0, _varinfo.xres-8, 0,
+				"The X-Position of the render rectangle; set render-rectangle to move and resize at once.",
+				0, G_MAXINT, 0,
 				G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property (gobject_class, PROP_RENDER_Y,
 			g_param_spec_uint ("render-y", "Render Y-pos.",
 				"The Y-Position of the render rectangle.",
-				0, _varinfo.yres-8, 0,
+				0, G_MAXINT, 0,
 				G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property (gobject_class, PROP_RENDER_W,
 			g_param_spec_uint ("render-width", "Render width.",
 				"The width of the render rectangle.",
-				0,  _varinfo.xres, 0,
+				0, G_MAXINT, 0,
 				G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property (gobject_class, PROP_RENDER_H,
 			g_param_spec_uint ("render-height", "Render height.",
 				"The height of the render rectangle.",
-				0, _varinfo.yres, 0,
+				0, G_MAXINT, 0,
 				G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_RENDER_RECTANGLE,
+			g_param_spec_string ("render-rectangle", "Render rectangle",
+				"The render rectangle as \"x,y,width,height\", set in one go and "
+				"applied with the next frame",
+				"0,0,0,0",
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BUFFERS,
+			g_param_spec_uint ("buffers", "Buffers",
+				"Number of frames in the overlay memory (1: single, 2: double, 3: triple buffering); "
+				"applied on the next reconfiguration",
+				1, MAX_BUFFERS, NUM_BUFFERS,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_VSYNC,
+			g_param_spec_boolean ("vsync", "VSync",
+				"Present frames from a separate thread, aligned to vsync",
+				TRUE,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_CONVERSION_THREADS,
+			g_param_spec_uint ("conversion-threads", "Conversion threads",
+				"Number of threads converting each frame in stripes (0: one per CPU)",
+				0, 8, 0,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_NATIVE_YUV420,
+			g_param_spec_boolean ("native-yuv420", "Native YUV420",
+				"Scan out I420 without converting it when the overlay supports a 4:2:0 layout",
+				FALSE,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_FRAMES_RENDERED,
+			g_param_spec_uint ("frames-rendered", "Frames rendered",
+				"Number of frames shown since the sink started",
+				0, G_MAXUINT, 0,
+				G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_FRAMES_DROPPED,
+			g_param_spec_uint ("frames-dropped", "Frames dropped",
+				"Number of frames received but never shown",
+				0, G_MAXUINT, 0,
+				G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_FRAMES_SKIPPED,
+			g_param_spec_uint ("frames-skipped", "Frames skipped",
+				"Number of frames that repeated the one on screen and were not "
+				"converted or shown again",
+				0, G_MAXUINT, 0,
+				G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_STATS,
+			g_param_spec_boxed ("stats", "Statistics",
+				"Frame counters and min/avg/max/p99 of the conversion, update and "
+				"arrival to display times in ns over the last frames",
+				GST_TYPE_STRUCTURE,
+				G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+			g_param_spec_uint ("stats-interval", "Statistics interval",
+				"Post an omapfb-stats element message every this many ms (0: never)",
+				0, G_MAXUINT, 0,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_OVERLAY_TIMEOUT,
+			g_param_spec_int ("overlay-timeout", "Overlay timeout",
+				"How long to wait in ms for a video overlay when all are in use, "
+				"also by other processes (0: fail right away, -1: wait forever)",
+				-1, G_MAXINT, 0,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_MOSAIC_GROUP,
+			g_param_spec_string ("mosaic-group", "Mosaic group",
+				"Sinks with the same group name share one video overlay, each drawing "
+				"into its render rectangle; applied when the sink starts",
+				NULL,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_TRACE,
+			g_param_spec_boolean ("trace", "Trace",
+				"Record frame events in the trace ring, shared by all sinks in the process",
+				FALSE,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_TRACE_DUMP,
+			g_param_spec_string ("trace-dump", "Trace dump",
+				"Write the recorded events to this file as Chrome trace JSON",
+				NULL,
+				G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_ROTATION,
+			g_param_spec_uint ("rotation", "Rotation",
+				"Clockwise rotation in degrees: 0, 90, 180 or 270 (planar formats only)",
+				0, 270, 0,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_MIRROR,
+			g_param_spec_boolean ("mirror", "Mirror",
+				"Flip the picture horizontally, after any rotation",
+				FALSE,
+				G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -653,45 +2123,81 @@ gst_omapfb_sink_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
 {
   struct gst_omapfb_sink *osink;
-  GstVideoRectangle old_rect;
-  int x, y, w, h;
+  GstVideoRectangle rect;
 
   g_return_if_fail (GST_IS_OMAPFBSINK (object));
   osink = GST_OMAPFBSINK (object);
-  old_rect = osink->render_rect;
 
   switch (prop_id) {
     case PROP_RENDER_X:
-	  x = (int) g_value_get_uint (value);
-	  osink->render_rect_changed |= (old_rect.x!=x);
-      g_atomic_int_set (&osink->render_rect.x, x);
-	  osink->have_render_rect = true;
-      break;
     case PROP_RENDER_Y:
-	  y = (int) g_value_get_uint (value);
-	  osink->render_rect_changed |= (old_rect.y!=y);
-      g_atomic_int_set (&osink->render_rect.y, y);
-	  osink->have_render_rect = true;
-      break;
     case PROP_RENDER_W:
-	  w = (int) g_value_get_uint (value);
-	  osink->render_rect_changed |= (old_rect.w!=w);
-      g_atomic_int_set (&osink->render_rect.w, w);
-	  osink->have_render_rect = true;
-      break;
     case PROP_RENDER_H:
-	  h = (int) g_value_get_uint (value);
-	  osink->render_rect_changed |= (old_rect.h!=h);
-      g_atomic_int_set (&osink->render_rect.h, h);
-	  osink->have_render_rect = true;
+	  /* one writer section, so setters of the other fields can't be lost */
+	  g_mutex_lock (&osink->rect_lock);
+	  rect = osink->render_rect;
+	  if (prop_id == PROP_RENDER_X)
+		rect.x = (int) g_value_get_uint (value);
+	  else if (prop_id == PROP_RENDER_Y)
+		rect.y = (int) g_value_get_uint (value);
+	  else if (prop_id == PROP_RENDER_W)
+		rect.w = (int) g_value_get_uint (value);
+	  else
+		rect.h = (int) g_value_get_uint (value);
+	  write_render_rect_locked (osink, &rect);
+	  g_mutex_unlock (&osink->rect_lock);
+      break;
+    case PROP_RENDER_RECTANGLE:
+	  if (sscanf (g_value_get_string (value), "%d,%d,%d,%d",
+				  &rect.x, &rect.y, &rect.w, &rect.h) == 4)
+		write_render_rect (osink, &rect);
+	  else
+		pr_err (osink, "render-rectangle must be x,y,w,h");
+      break;
+    case PROP_BUFFERS:
+	  osink->req_buffers = g_value_get_uint (value);
+	  /* the slots are laid out again with the next frame */
+	  write_render_rect (osink, NULL);
+      break;
+    case PROP_VSYNC:
+	  osink->vsync = g_value_get_boolean (value);
+      break;
+    case PROP_CONVERSION_THREADS:
+	  osink->conversion_threads = g_value_get_uint (value);
+      break;
+    case PROP_NATIVE_YUV420:
+	  osink->yuv420 = g_value_get_boolean (value);
+	  osink->yuv420_rejected = false;
+      break;
+    case PROP_STATS_INTERVAL:
+	  osink->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_OVERLAY_TIMEOUT:
+	  osink->overlay_timeout = g_value_get_int (value);
+      break;
+    case PROP_MOSAIC_GROUP:
+	  g_free (osink->mosaic_group);
+	  osink->mosaic_group = g_value_dup_string (value);
+      break;
+    case PROP_TRACE:
+	  trace_enable (g_value_get_boolean (value));
+      break;
+    case PROP_TRACE_DUMP:
+	  if (g_value_get_string (value) && !trace_dump (g_value_get_string (value)))
+		pr_err (osink, "could not write trace to %s", g_value_get_string (value));
+      break;
+    case PROP_ROTATION:
+	  osink->rotation = g_value_get_uint (value) / 90 * 90;
+	  write_render_rect (osink, NULL);
+      break;
+    case PROP_MIRROR:
+	  osink->mirror = g_value_get_boolean (value);
+	  write_render_rect (osink, NULL);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
-
-  if (osink->render_rect_changed)
-	check_render_rect(osink);
 }
 
 static void
@@ -699,26 +2205,75 @@ gst_omapfb_sink_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
 {
   struct gst_omapfb_sink *osink;
+  GstVideoRectangle rect;
+  gboolean have_rect;
 
   g_return_if_fail (GST_IS_OMAPFBSINK (object));
   osink = GST_OMAPFBSINK (object);
 
   switch (prop_id) {
     case PROP_RENDER_X:
-      g_value_set_boolean (value,
-          g_atomic_int_get (&osink->render_rect.x));
+      read_render_rect (osink, &rect, &have_rect);
+      g_value_set_uint (value, rect.x);
       break;
     case PROP_RENDER_Y:
-      g_value_set_boolean (value,
-          g_atomic_int_get (&osink->render_rect.y));
+      read_render_rect (osink, &rect, &have_rect);
+      g_value_set_uint (value, rect.y);
       break;
     case PROP_RENDER_W:
-      g_value_set_boolean (value,
-          g_atomic_int_get (&osink->render_rect.w));
+      read_render_rect (osink, &rect, &have_rect);
+      g_value_set_uint (value, rect.w);
       break;
     case PROP_RENDER_H:
-      g_value_set_boolean (value,
-          g_atomic_int_get (&osink->render_rect.h));
+      read_render_rect (osink, &rect, &have_rect);
+      g_value_set_uint (value, rect.h);
+      break;
+    case PROP_RENDER_RECTANGLE:
+      read_render_rect (osink, &rect, &have_rect);
+      g_value_take_string (value, g_strdup_printf ("%d,%d,%d,%d",
+            rect.x, rect.y, rect.w, rect.h));
+      break;
+    case PROP_BUFFERS:
+      g_value_set_uint (value, osink->req_buffers);
+      break;
+    case PROP_VSYNC:
+      g_value_set_boolean (value, osink->vsync);
+      break;
+    case PROP_CONVERSION_THREADS:
+      g_value_set_uint (value, osink->conversion_threads);
+      break;
+    case PROP_NATIVE_YUV420:
+      g_value_set_boolean (value, osink->yuv420);
+      break;
+    case PROP_FRAMES_RENDERED:
+      g_value_set_uint (value, g_atomic_int_get (&osink->frames_rendered));
+      break;
+    case PROP_FRAMES_DROPPED:
+      g_value_set_uint (value, g_atomic_int_get (&osink->frames_dropped));
+      break;
+    case PROP_FRAMES_SKIPPED:
+      g_value_set_uint (value, g_atomic_int_get (&osink->frames_skipped));
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, stats_structure (osink, "omapfb-stats"));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, osink->stats_interval);
+      break;
+    case PROP_OVERLAY_TIMEOUT:
+      g_value_set_int (value, osink->overlay_timeout);
+      break;
+    case PROP_MOSAIC_GROUP:
+      g_value_set_string (value, osink->mosaic_group);
+      break;
+    case PROP_TRACE:
+      g_value_set_boolean (value, trace_enabled ());
+      break;
+    case PROP_ROTATION:
+      g_value_set_uint (value, osink->rotation);
+      break;
+    case PROP_MIRROR:
+      g_value_set_boolean (value, osink->mirror);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -734,11 +2289,19 @@ gst_omapfb_sink_init (struct gst_omapfb_sink * omapfbsink)
   omapfbsink->render_rect.w = 0;
   omapfbsink->render_rect.h = 0;
   omapfbsink->have_render_rect = false;
-  omapfbsink->render_rect_changed = false;
+  g_mutex_init(&omapfbsink->rect_lock);
   omapfbsink->overlay_fd = 0;
+  omapfbsink->devid = -1;
   omapfbsink->caps = NULL;
-  hide_framebuffer(omapfbsink, "/dev/fb1");
-  hide_framebuffer(omapfbsink, "/dev/fb2");
+  omapfbsink->req_buffers = NUM_BUFFERS;
+  omapfbsink->vsync = true;
+  omapfbsink->pending = omapfbsink->retiring = -1;
+  gst_base_sink_set_qos_enabled((GstBaseSink *) omapfbsink, TRUE);
+  gst_base_sink_set_max_lateness((GstBaseSink *) omapfbsink, 20 * GST_MSECOND);
+  gst_pad_add_buffer_probe(GST_BASE_SINK_PAD(omapfbsink), G_CALLBACK(buffer_arrived), omapfbsink);
+  g_mutex_init(&omapfbsink->slot_lock);
+  g_mutex_init(&omapfbsink->dev_lock);
+  g_cond_init(&omapfbsink->present_cond);
 }
 
 GType
@@ -769,6 +2332,8 @@ plugin_init(GstPlugin *plugin)
 	omapfb_debug = _gst_debug_category_new("omapfb", 0, "omapfb");
 #endif
 
+	trace_init();
+
 	if (!gst_element_register(plugin, "omapfbsink", GST_RANK_SECONDARY, GST_OMAPFB_SINK_TYPE))
 		return false;
 
@@ -12,6 +12,7 @@
 #define OMAPFB_H
 
 #include <glib-object.h>
+#include <gst/gst.h>
 
 #define GST_OMAPFB_SINK_TYPE (gst_omapfb_sink_get_type())
 
@@ -0,0 +1,300 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "overlay-alloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <linux/fb.h>
+#include <linux/omapfb.h>
+
+#include "log.h"
+
+#define MAX_OVERLAYS 8
+#define TABLE_MAGIC 0x6f766c31 /* "ovl1" */
+#define DEFAULT_TABLE "/dev/shm/omapfb-overlays"
+#define WAIT_STEP_MS 50
+
+struct overlay_entry {
+	int32_t pid;
+	uint32_t mem_size;
+};
+
+struct overlay_table {
+	uint32_t magic;
+	struct overlay_entry entries[MAX_OVERLAYS];
+};
+
+struct table_handle {
+	int fd;
+	struct overlay_table table;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct overlay_table local_table;
+static bool initialized;
+static bool shared;
+static unsigned noverlays;
+
+/* overlays are the devices after the display that answer OMAPFB_QUERY_PLANE */
+static unsigned
+discover(const struct omapfb_backend *backend)
+{
+	struct omapfb_plane_info plane;
+	char path[16];
+	unsigned i;
+	int fd, ok;
+
+	for (i = 1; i <= MAX_OVERLAYS; i++) {
+		snprintf(path, sizeof(path), "/dev/fb%u", i);
+		fd = backend->open(path, O_RDWR);
+		if (fd < 0)
+			break;
+		ok = !backend->ioctl(fd, OMAPFB_QUERY_PLANE, &plane);
+		backend->close(fd);
+		if (!ok)
+			break;
+	}
+
+	return i - 1;
+}
+
+static size_t
+budget(void)
+{
+	const char *value = getenv("OMAPFB_VRAM_BUDGET");
+	unsigned long size;
+	char *end;
+
+	if (!value)
+		return 0;
+
+	size = strtoul(value, &end, 0);
+	if (*end == 'k' || *end == 'K')
+		size <<= 10;
+	else if (*end == 'm' || *end == 'M')
+		size <<= 20;
+
+	return size;
+}
+
+/* without the shared file, overlays are still handed out within the process */
+static void
+local_fallback(struct table_handle *h, const char *path)
+{
+	pr_warning(NULL, "could not use overlay table %s: %s; not coordinating with other processes",
+			path, strerror(errno));
+	shared = false;
+	h->fd = -1;
+	h->table = local_table;
+}
+
+/*
+ * Lock and load the table. The process lock is always taken; the shared
+ * file is opened anew every time, so its flock() also excludes other sinks
+ * of this process.
+ */
+static void
+table_open(struct table_handle *h)
+{
+	const char *path;
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+
+	if (!shared) {
+		h->fd = -1;
+		h->table = local_table;
+		return;
+	}
+
+	path = getenv("OMAPFB_OVERLAY_TABLE");
+	if (!path)
+		path = DEFAULT_TABLE;
+
+	h->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (h->fd < 0) {
+		local_fallback(h, path);
+		return;
+	}
+
+	/* other users share it too, whatever our umask */
+	fchmod(h->fd, 0666);
+
+	if (flock(h->fd, LOCK_EX)) {
+		int fd = h->fd;
+
+		local_fallback(h, path);
+		close(fd);
+		return;
+	}
+
+	if (pread(h->fd, &h->table, sizeof(h->table), 0) != sizeof(h->table) ||
+			h->table.magic != TABLE_MAGIC) {
+		memset(&h->table, 0, sizeof(h->table));
+		h->table.magic = TABLE_MAGIC;
+	}
+
+	/* reclaim the overlays of processes that died without releasing them */
+	for (i = 0; i < MAX_OVERLAYS; i++) {
+		struct overlay_entry *e = &h->table.entries[i];
+
+		if (e->pid && kill(e->pid, 0) && errno == ESRCH)
+			memset(e, 0, sizeof(*e));
+	}
+}
+
+static void
+table_close(struct table_handle *h)
+{
+	if (h->fd < 0) {
+		local_table = h->table;
+	} else {
+		if (pwrite(h->fd, &h->table, sizeof(h->table), 0) != sizeof(h->table))
+			pr_err(NULL, "could not write the overlay table");
+		flock(h->fd, LOCK_UN);
+		close(h->fd);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void
+init(const struct omapfb_backend *backend)
+{
+	pthread_mutex_lock(&lock);
+	if (!initialized) {
+		shared = backend == &omapfb_linux_backend;
+		noverlays = discover(backend);
+		initialized = true;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int
+overlay_acquire(const struct omapfb_backend *backend, int timeout_ms)
+{
+	struct table_handle h;
+	int waited = 0;
+	unsigned i;
+
+	init(backend);
+
+	for (;;) {
+		table_open(&h);
+
+		for (i = 0; i < noverlays; i++) {
+			struct overlay_entry *e = &h.table.entries[i];
+
+			if (!e->pid) {
+				e->pid = getpid();
+				e->mem_size = 0;
+				break;
+			}
+		}
+
+		table_close(&h);
+
+		if (i < noverlays)
+			return i + 1;
+
+		if (timeout_ms >= 0 && waited >= timeout_ms)
+			return -1;
+
+		usleep(WAIT_STEP_MS * 1000);
+		waited += WAIT_STEP_MS;
+	}
+}
+
+void
+overlay_release(int index)
+{
+	struct table_handle h;
+	struct overlay_entry *e;
+
+	if (index < 1 || index > MAX_OVERLAYS)
+		return;
+
+	table_open(&h);
+
+	e = &h.table.entries[index - 1];
+	if (e->pid == getpid())
+		memset(e, 0, sizeof(*e));
+
+	table_close(&h);
+}
+
+bool
+overlay_reserve(int index, size_t size)
+{
+	struct table_handle h;
+	size_t limit = budget();
+	size_t total = 0;
+	unsigned i;
+	bool ok;
+
+	if (index < 1 || index > MAX_OVERLAYS)
+		return false;
+
+	table_open(&h);
+
+	for (i = 0; i < MAX_OVERLAYS; i++) {
+		if (i != (unsigned) index - 1 && h.table.entries[i].pid)
+			total += h.table.entries[i].mem_size;
+	}
+
+	ok = !limit || total + size <= limit;
+	if (ok)
+		h.table.entries[index - 1].mem_size = size;
+
+	table_close(&h);
+
+	return ok;
+}
+
+void
+overlay_hide_idle(const struct omapfb_backend *backend)
+{
+	struct omapfb_plane_info plane;
+	struct table_handle h;
+	char path[16];
+	unsigned i;
+	int fd;
+
+	init(backend);
+
+	/* holding the table keeps the overlays from being acquired meanwhile */
+	table_open(&h);
+
+	for (i = 0; i < noverlays; i++) {
+		if (h.table.entries[i].pid)
+			continue;
+
+		snprintf(path, sizeof(path), "/dev/fb%u", i + 1);
+		fd = backend->open(path, O_RDWR);
+		if (fd < 0)
+			continue;
+
+		if (!backend->ioctl(fd, OMAPFB_QUERY_PLANE, &plane) && plane.enabled) {
+			plane.enabled = 0;
+			if (backend->ioctl(fd, OMAPFB_SETUP_PLANE, &plane))
+				pr_err(NULL, "could not disable plane %s", path);
+		}
+		backend->close(fd);
+	}
+
+	table_close(&h);
+}
@@ -0,0 +1,44 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef OVERLAY_ALLOC_H
+#define OVERLAY_ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "backend.h"
+
+/*
+ * Overlay allocator.
+ *
+ * Hands out the video overlays, /dev/fb1 and up, to one owner at a time and
+ * accounts the overlay memory each owner has set up against an optional
+ * budget. With the linux backend the table is a file locked with flock(),
+ * so separate processes never share an overlay; entries of processes that
+ * died are reclaimed. The mock backend uses a table local to the process,
+ * and so does the linux one when the file can't be opened or locked.
+ *
+ * Environment:
+ *   OMAPFB_OVERLAY_TABLE  shared table, /dev/shm/omapfb-overlays by default
+ *   OMAPFB_VRAM_BUDGET    total overlay memory in bytes, with an optional k
+ *                         or M suffix; unlimited by default
+ */
+
+/*
+ * Index of a free overlay, waiting up to timeout_ms for one to be released
+ * (0: don't wait, -1: wait forever); -1 if there is none.
+ */
+int overlay_acquire(const struct omapfb_backend *backend, int timeout_ms);
+void overlay_release(int index);
+
+/* account size bytes of memory to the overlay; false if over the budget */
+bool overlay_reserve(int index, size_t size);
+
+/* disable the planes of overlays nobody owns, left enabled by a process that crashed */
+void overlay_hide_idle(const struct omapfb_backend *backend);
+
+#endif /* OVERLAY_ALLOC_H */
@@ -0,0 +1,70 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+stats_series_reset(struct stats_series *s)
+{
+	__atomic_store_n(&s->count, 0, __ATOMIC_RELEASE);
+}
+
+void
+stats_series_add(struct stats_series *s, uint64_t value)
+{
+	unsigned count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+
+	s->samples[count % STATS_WINDOW] = value;
+	__atomic_store_n(&s->count, count + 1, __ATOMIC_RELEASE);
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+void
+stats_series_summarize(struct stats_series *s, struct stats_summary *summary)
+{
+	uint64_t samples[STATS_WINDOW];
+	uint64_t sum = 0;
+	unsigned count, n, i;
+
+	count = __atomic_load_n(&s->count, __ATOMIC_ACQUIRE);
+	n = count < STATS_WINDOW ? count : STATS_WINDOW;
+
+	memset(summary, 0, sizeof(*summary));
+	if (!n)
+		return;
+
+	memcpy(samples, s->samples, n * sizeof(samples[0]));
+	qsort(samples, n, sizeof(samples[0]), compare_samples);
+
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+
+	summary->samples = n;
+	summary->min = samples[0];
+	summary->max = samples[n - 1];
+	summary->avg = sum / n;
+	summary->p99 = samples[(n * 99 + 99) / 100 - 1];
+}
@@ -0,0 +1,36 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Rolling window of timings in nanoseconds. Each series has a single writer
+ * and never takes a lock; readers summarize a snapshot, which may be off by
+ * a sample while it's being written.
+ */
+
+#define STATS_WINDOW 128
+
+struct stats_series {
+	uint64_t samples[STATS_WINDOW];
+	volatile unsigned count;
+};
+
+struct stats_summary {
+	unsigned samples;
+	uint64_t min, avg, max, p99;
+};
+
+uint64_t stats_now(void);
+
+void stats_series_reset(struct stats_series *s);
+void stats_series_add(struct stats_series *s, uint64_t value);
+void stats_series_summarize(struct stats_series *s, struct stats_summary *summary);
+
+#endif /* STATS_H */
@@ -0,0 +1,200 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+/*
+ * Each slot works like a seqlock: seq is 0 while the slot is written and
+ * n + 1 once it holds event n, so the dump skips torn or reused slots.
+ */
+struct trace_event {
+	unsigned seq;
+	char phase;
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+	int64_t arg;
+	int tid;
+};
+
+volatile int trace_on;
+
+static struct trace_event ring[TRACE_EVENTS];
+static unsigned head;
+static const char *dump_path;
+static sem_t dump_requests;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int thread_id;
+
+static void
+record(char phase, const char *name, uint64_t start, uint64_t duration, int64_t arg)
+{
+	unsigned n = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	struct trace_event *e = &ring[n % TRACE_EVENTS];
+
+	if (!thread_id)
+		thread_id = syscall(SYS_gettid);
+
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	e->phase = phase;
+	e->name = name;
+	e->start = start;
+	e->duration = duration;
+	e->arg = arg;
+	e->tid = thread_id;
+
+	__atomic_store_n(&e->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_span(const char *name, uint64_t start, uint64_t end, int64_t arg)
+{
+	if (trace_enabled())
+		record('X', name, start, end - start, arg);
+}
+
+void
+trace_mark(const char *name, int64_t arg)
+{
+	if (trace_enabled())
+		record('i', name, stats_now(), 0, arg);
+}
+
+void
+trace_enable(bool enable)
+{
+	__atomic_store_n(&trace_on, enable, __ATOMIC_RELAXED);
+}
+
+static void
+request_dump(int sig)
+{
+	int saved_errno = errno;
+
+	sem_post(&dump_requests);
+	errno = saved_errno;
+}
+
+/*
+ * The handler only posts the request; the file is written from this
+ * thread, so a dump is taken even while no frames arrive.
+ */
+static void *
+dump_loop(void *data)
+{
+	for (;;) {
+		if (sem_wait(&dump_requests))
+			continue;
+		trace_dump(NULL);
+	}
+
+	return NULL;
+}
+
+void
+trace_init(void)
+{
+	struct sigaction sa;
+	pthread_t thread;
+
+	dump_path = getenv("OMAPFB_TRACE");
+	if (!dump_path || !*dump_path) {
+		dump_path = NULL;
+		return;
+	}
+
+	sem_init(&dump_requests, 0, 0);
+	if (pthread_create(&thread, NULL, dump_loop, NULL)) {
+		pr_err(NULL, "could not create trace dump thread");
+	} else {
+		pthread_detach(thread);
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = request_dump;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGUSR2, &sa, NULL);
+	}
+
+	trace_enable(true);
+}
+
+bool
+trace_dump(const char *path)
+{
+	unsigned end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	unsigned n = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+	int pid = getpid();
+	bool first = true;
+	bool ok;
+	FILE *f;
+
+	if (!path)
+		path = dump_path;
+	if (!path)
+		return false;
+
+	/* SIGUSR2 and a stopping sink may ask for the same file at once */
+	pthread_mutex_lock(&dump_lock);
+
+	f = fopen(path, "w");
+	if (!f) {
+		pthread_mutex_unlock(&dump_lock);
+		return false;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (; n != end; n++) {
+		struct trace_event *e = &ring[n % TRACE_EVENTS];
+		struct trace_event copy;
+
+		if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != n + 1)
+			continue;
+		copy.phase = e->phase;
+		copy.name = e->name;
+		copy.start = e->start;
+		copy.duration = e->duration;
+		copy.arg = e->arg;
+		copy.tid = e->tid;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != n + 1)
+			continue;
+
+		/* Chrome wants microseconds */
+		fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"omapfb\",\"ph\":\"%c\",\"ts\":%.3f,",
+				first ? "" : ",\n", copy.name, copy.phase, copy.start / 1e3);
+		if (copy.phase == 'X')
+			fprintf(f, "\"dur\":%.3f,", copy.duration / 1e3);
+		else
+			fprintf(f, "\"s\":\"t\",");
+		fprintf(f, "\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%lld}}",
+				pid, copy.tid, (long long) copy.arg);
+		first = false;
+	}
+
+	fprintf(f, "\n]}\n");
+
+	ok = !fclose(f);
+	pthread_mutex_unlock(&dump_lock);
+
+	return ok;
+}
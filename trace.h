@@ -0,0 +1,50 @@
+/*
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Frame event trace.
+ *
+ * A fixed ring of the last TRACE_EVENTS timestamped events, written by any
+ * thread without locking; older events are overwritten. trace_dump() writes
+ * it out as Chrome trace JSON, for chrome://tracing or Perfetto. Recording
+ * is off until trace_enable(); event names must be string literals.
+ *
+ * Environment:
+ *   OMAPFB_TRACE  enable recording from the start and dump to this path on
+ *                 SIGUSR2 and whenever a sink stops
+ */
+
+#define TRACE_EVENTS 8192
+
+extern volatile int trace_on;
+
+static inline bool
+trace_enabled(void)
+{
+	return __atomic_load_n(&trace_on, __ATOMIC_RELAXED);
+}
+
+/* reads OMAPFB_TRACE */
+void trace_init(void);
+
+void trace_enable(bool enable);
+
+/* a span from start to end, in stats_now() time */
+void trace_span(const char *name, uint64_t start, uint64_t end, int64_t arg);
+
+/* something that happened now */
+void trace_mark(const char *name, int64_t arg);
+
+/* NULL writes to the OMAPFB_TRACE path */
+bool trace_dump(const char *path);
+
+#endif /* TRACE_H */